@@ -1,9 +1,1076 @@
 
-#include <sstream>
+#include <errno.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <map>
+#include <memory>
 #include "tinyJson.h"
 
 namespace tinyjson
 {
+void *MemArena::Alloc(size_t size, size_t align)
+{
+    if (_region != nullptr) {
+        return _region->Alloc(size, align);
+    }
+    size_t pad = (size_t)(-(intptr_t)_current) & (align - 1);
+    if (_current == nullptr || pad + size > _left) {
+        // Big requests get a block of their own so they don't waste the rest of the current one.
+        if (size + align > BLOCK_SIZE / 4) {
+            char *block = AllocBig(size + align);
+            return block + ((size_t)(-(intptr_t)block) & (align - 1));
+        }
+        if (_nextBlock == _blockPtrs.Size()) {
+            _blockPtrs.Push(new char[BLOCK_SIZE]);
+        }
+        _current = _blockPtrs[_nextBlock++];
+        _left = BLOCK_SIZE;
+        pad = (size_t)(-(intptr_t)_current) & (align - 1);
+    }
+    char *result = _current + pad;
+    _current = result + size;
+    _left -= pad + size;
+    return result;
+}
+
+char *MemArena::StrDup(const char *str, size_t len)
+{
+    char *copy = (char *)Alloc(len + 1, 1);
+    if (copy == nullptr) {
+        return nullptr;
+    }
+    memcpy(copy, str, len);
+    copy[len] = 0;
+    return copy;
+}
+
+void MemArena::Clear()
+{
+    for (int i = 0; i < _blockPtrs.Size(); ++i) {
+        delete[] _blockPtrs[i];
+    }
+    _blockPtrs.Clear();
+    for (int i = 0; i < _bigBlocks.Size(); ++i) {
+        delete[] _bigBlocks[i].mem;
+    }
+    _bigBlocks.Clear();
+    Reset();
+}
+
+void MemArena::Reset()
+{
+    for (int i = 0; i < _spareBlocks.Size(); ++i) {
+        delete[] _spareBlocks[i].mem;
+    }
+    _spareBlocks.Clear();
+    for (int i = 0; i < _bigBlocks.Size(); ++i) {
+        _spareBlocks.Push(_bigBlocks[i]);
+    }
+    _bigBlocks.Clear();
+    _nextBlock = 0;
+    _current = nullptr;
+    _left = 0;
+}
+
+char *MemArena::AllocBig(size_t size)
+{
+    BigBlock block = { nullptr, size };
+    for (int i = 0; i < _spareBlocks.Size(); ++i) {
+        if (_spareBlocks[i].size >= size) {
+            block = _spareBlocks[i];
+            _spareBlocks[i] = _spareBlocks[_spareBlocks.Size() - 1];
+            _spareBlocks.Pop();
+            break;
+        }
+    }
+    if (block.mem == nullptr) {
+        block.mem = new char[size];
+    }
+    _bigBlocks.Push(block);
+    return block.mem;
+}
+
+static inline uint32_t HashStr(const char *str, size_t len)
+{
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < len; ++i) {
+        hash = (hash ^ (unsigned char)str[i]) * 16777619u;
+    }
+    return hash;
+}
+
+const char *StrTable::Intern(const char *str, size_t len)
+{
+    if ((_size + 1) * 4 > _capacity * 3) {
+        Grow();
+    }
+    uint32_t hash = HashStr(str, len);
+    int mask = _capacity - 1;
+    for (int i = (int)(hash & mask);; i = (i + 1) & mask) {
+        Slot &slot = _slots[i];
+        if (slot.str == nullptr) {
+            slot.str = _arena->StrDup(str, len);
+            slot.len = len;
+            slot.hash = hash;
+            ++_size;
+            return slot.str;
+        }
+        if (slot.hash == hash && slot.len == len && !memcmp(slot.str, str, len)) {
+            return slot.str;
+        }
+    }
+}
+
+void StrTable::Grow()
+{
+    int capacity = _capacity != 0 ? _capacity * 2 : 64;
+    Slot *slots = new Slot[capacity];
+    memset(slots, 0, sizeof(Slot) * capacity);
+    for (int i = 0; i < _capacity; ++i) {
+        if (_slots[i].str != nullptr) {
+            int j = (int)(_slots[i].hash & (capacity - 1));
+            while (slots[j].str != nullptr) {
+                j = (j + 1) & (capacity - 1);
+            }
+            slots[j] = _slots[i];
+        }
+    }
+    delete[] _slots;
+    _slots = slots;
+    _capacity = capacity;
+}
+
+void StrTable::Clear()
+{
+    if (_slots != nullptr) {
+        memset(_slots, 0, sizeof(Slot) * _capacity);
+    }
+    _size = 0;
+}
+
+/********************************************************************************************/
+
+// Length of the UTF-8 sequence at s, or 0 if it is malformed. Overlong forms, surrogates and
+// code points above U+10FFFF are malformed.
+static size_t UTF8SequenceLength(const unsigned char *s, size_t left)
+{
+    unsigned char c = s[0];
+    if (c < 0x80) {
+        return 1;
+    }
+    size_t n = 0;
+    unsigned char lo = 0x80;
+    unsigned char hi = 0xBF;
+    if (c >= 0xC2 && c <= 0xDF) {
+        n = 2;
+    } else if (c >= 0xE0 && c <= 0xEF) {
+        n = 3;
+        if (c == 0xE0) {
+            lo = 0xA0;
+        } else if (c == 0xED) {
+            hi = 0x9F;
+        }
+    } else if (c >= 0xF0 && c <= 0xF4) {
+        n = 4;
+        if (c == 0xF0) {
+            lo = 0x90;
+        } else if (c == 0xF4) {
+            hi = 0x8F;
+        }
+    } else {
+        return 0;
+    }
+    if (left < n || s[1] < lo || s[1] > hi) {
+        return 0;
+    }
+    for (size_t i = 2; i < n; ++i) {
+        if ((s[i] & 0xC0) != 0x80) {
+            return 0;
+        }
+    }
+    return n;
+}
+
+bool JsonUtil::IsValidUTF8(const char *p, size_t len)
+{
+    const unsigned char *s = reinterpret_cast<const unsigned char *>(p);
+    size_t i = 0;
+    while (i < len) {
+        size_t n = UTF8SequenceLength(s + i, len - i);
+        if (n == 0) {
+            return false;
+        }
+        i += n;
+    }
+    return true;
+}
+
+size_t JsonUtil::CleanRun(const char *p, size_t len, bool asciiOnly)
+{
+    for (size_t i = 0; i < len; ++i) {
+        unsigned char c = (unsigned char)p[i];
+        if (c < 0x20 || c == '\"' || c == '\\' || (asciiOnly && c >= 0x80)) {
+            return i;
+        }
+    }
+    return len;
+}
+
+static bool ParseHex4(const char *p, const char *end, uint32_t *value)
+{
+    if (end - p < 4) {
+        return false;
+    }
+    uint32_t v = 0;
+    for (int i = 0; i < 4; ++i) {
+        char c = p[i];
+        if (c >= '0' && c <= '9') {
+            v = v * 16 + (c - '0');
+        } else if ((c | 0x20) >= 'a' && (c | 0x20) <= 'f') {
+            v = v * 16 + ((c | 0x20) - 'a' + 10);
+        } else {
+            return false;
+        }
+    }
+    *value = v;
+    return true;
+}
+
+static char *EncodeUTF8(uint32_t cp, char *out)
+{
+    if (cp < 0x80) {
+        *out++ = (char)cp;
+    } else if (cp < 0x800) {
+        *out++ = (char)(0xC0 | (cp >> 6));
+        *out++ = (char)(0x80 | (cp & 0x3F));
+    } else if (cp < 0x10000) {
+        *out++ = (char)(0xE0 | (cp >> 12));
+        *out++ = (char)(0x80 | ((cp >> 6) & 0x3F));
+        *out++ = (char)(0x80 | (cp & 0x3F));
+    } else {
+        *out++ = (char)(0xF0 | (cp >> 18));
+        *out++ = (char)(0x80 | ((cp >> 12) & 0x3F));
+        *out++ = (char)(0x80 | ((cp >> 6) & 0x3F));
+        *out++ = (char)(0x80 | (cp & 0x3F));
+    }
+    return out;
+}
+
+// Every escape is at least as long as what it decodes to, so out never overtakes p.
+char *JsonUtil::UnescapeString(char *start, char *end)
+{
+    char *out = start;
+    char *p = start;
+    for (;;) {
+        char *slash = static_cast<char *>(memchr(p, '\\', end - p));
+        if (slash == nullptr) {
+            slash = end;
+        }
+        if (out != p) {
+            memmove(out, p, slash - p);
+        }
+        out += slash - p;
+        p = slash;
+        if (p == end) {
+            return out;
+        }
+        if (end - p < 2) {
+            return nullptr;
+        }
+        switch (p[1]) {
+        case '\"':
+        case '\\':
+        case '/':
+            *out++ = p[1];
+            break;
+        case 'b':
+            *out++ = '\b';
+            break;
+        case 'f':
+            *out++ = '\f';
+            break;
+        case 'n':
+            *out++ = '\n';
+            break;
+        case 'r':
+            *out++ = '\r';
+            break;
+        case 't':
+            *out++ = '\t';
+            break;
+        case 'u': {
+            uint32_t cp;
+            if (!ParseHex4(p + 2, end, &cp)) {
+                return nullptr;
+            }
+            p += 4;
+            uint32_t low;
+            if (cp >= 0xD800 && cp <= 0xDBFF && end - p >= 8 && p[2] == '\\' && p[3] == 'u'
+                    && ParseHex4(p + 4, end, &low) && low >= 0xDC00 && low <= 0xDFFF) {
+                cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+                p += 6;
+            }
+            out = EncodeUTF8(cp, out);
+            break;
+        }
+        default:
+            return nullptr;
+        }
+        p += 2;
+    }
+}
+
+static inline bool IsStructural(char c)
+{
+    switch (c) {
+    case '{':
+    case '}':
+    case '[':
+    case ']':
+    case ':':
+    case ',':
+    case '\"':
+    case '\\':
+        return true;
+    default:
+        return false;
+    }
+}
+
+// Scalar part of IndexStructurals from offset i on, appending after the count entries already
+// in out. The SIMD versions use it for the tail that is shorter than a vector.
+static size_t IndexStructuralsFrom(const char *p, size_t i, size_t len, uint32_t *out, size_t count)
+{
+    for (; i < len; ++i) {
+        if (IsStructural(p[i])) {
+            out[count++] = (uint32_t)i;
+        }
+    }
+    return count;
+}
+
+size_t JsonUtil::IndexStructurals(const char *p, size_t len, uint32_t *out)
+{
+    return IndexStructuralsFrom(p, 0, len, out, 0);
+}
+
+static const double exactPowersOf10[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+// SWAR check and conversion of 8 ASCII digits, first digit in the lowest byte.
+static inline bool IsEightDigits(uint64_t v)
+{
+    return ((v & 0xF0F0F0F0F0F0F0F0ull) | (((v + 0x0606060606060606ull) & 0xF0F0F0F0F0F0F0F0ull) >> 4))
+        == 0x3333333333333333ull;
+}
+
+static inline uint32_t ParseEightDigits(uint64_t v)
+{
+    v -= 0x3030303030303030ull;
+    v = (v * 10) + (v >> 8);
+    v = (((v & 0x000000FF000000FFull) * (100 + (1000000ull << 32)))
+        + (((v >> 16) & 0x000000FF000000FFull) * (1 + (10000ull << 32)))) >> 32;
+    return (uint32_t)v;
+}
+
+static inline uint64_t LoadWord(const char *p)
+{
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    v = __builtin_bswap64(v);
+#endif
+    return v;
+}
+
+// Appends the digits at p to *mantissa, counting them in *digits. Only the first 19 digits are
+// accumulated, which always fits in 64 bits.
+static inline const char *ParseDigits(const char *p, uint64_t *mantissa, int *digits)
+{
+    while (*digits + 8 <= 19) {
+        uint64_t word = LoadWord(p);
+        if (!IsEightDigits(word)) {
+            break;
+        }
+        *mantissa = *mantissa * 100000000 + ParseEightDigits(word);
+        *digits += 8;
+        p += 8;
+    }
+    while (*p >= '0' && *p <= '9') {
+        if (*digits < 19) {
+            *mantissa = *mantissa * 10 + (uint64_t)(*p - '0');
+        }
+        ++*digits;
+        ++p;
+    }
+    return p;
+}
+
+const char *JsonUtil::ParseNumber(const char *p, bool *isInt, int64_t *intValue, double *doubleValue)
+{
+    const char *start = p;
+    bool negative = *p == '-';
+    if (negative) {
+        ++p;
+    }
+    if (*p < '0' || *p > '9') {
+        return nullptr;
+    }
+
+    uint64_t mantissa = 0;
+    int digits = 0;
+    int exponent = 0;
+    if (*p == '0') {
+        ++p;
+    } else {
+        p = ParseDigits(p, &mantissa, &digits);
+    }
+    int intDigits = digits;
+
+    bool integral = true;
+    if (*p == '.') {
+        ++p;
+        if (*p < '0' || *p > '9') {
+            return nullptr;
+        }
+        integral = false;
+        const char *fraction = p;
+        p = ParseDigits(p, &mantissa, &digits);
+        exponent -= (int)(p - fraction);
+    }
+    if (*p == 'e' || *p == 'E') {
+        ++p;
+        bool negativeExponent = *p == '-';
+        if (*p == '-' || *p == '+') {
+            ++p;
+        }
+        if (*p < '0' || *p > '9') {
+            return nullptr;
+        }
+        integral = false;
+        int e = 0;
+        while (*p >= '0' && *p <= '9') {
+            if (e < 100000) {
+                e = e * 10 + (*p - '0');
+            }
+            ++p;
+        }
+        exponent += negativeExponent ? -e : e;
+    }
+
+    *isInt = integral && intDigits <= 19 && !(negative && mantissa == 0)
+        && mantissa <= (negative ? (uint64_t)INT64_MAX + 1 : (uint64_t)INT64_MAX);
+    if (*isInt) {
+        *intValue = negative ? (int64_t)(0 - mantissa) : (int64_t)mantissa;
+        *doubleValue = (double)*intValue;
+        return p;
+    }
+
+    // Exact when both the mantissa and the power of ten are exactly representable; anything
+    // else goes to strtod, which rounds correctly.
+    if (digits <= 19 && mantissa <= (1ull << 53) && exponent >= -22 && exponent <= 22) {
+        double d = (double)mantissa;
+        d = exponent < 0 ? d / exactPowersOf10[-exponent] : d * exactPowersOf10[exponent];
+        *doubleValue = negative ? -d : d;
+    } else {
+        *doubleValue = strtod(start, nullptr);
+    }
+    return p;
+}
+
+char *JsonUtil::SkipContainer(char *p)
+{
+    const char *(*scanString)(const char *) = JsonKernels::Get().scanString;
+    int depth = 1;
+    for (;; ++p) {
+        switch (*p) {
+        case 0:
+            return nullptr;
+        case '\"':
+            for (++p;; p += 2) {
+                p = const_cast<char *>(scanString(p));
+                if (*p != '\\' || !p[1]) {
+                    break;
+                }
+            }
+            if (*p != '\"') {
+                return nullptr;
+            }
+            break;
+        case '{':
+        case '[':
+            if (++depth > TINYJSON_MAX_DEPTH) {
+                return nullptr;
+            }
+            break;
+        case '}':
+        case ']':
+            if (--depth == 0) {
+                return p + 1;
+            }
+            break;
+        default:
+            break;
+        }
+    }
+}
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define TJ_X86
+#include <immintrin.h>
+
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#define TJ_TARGET(x)
+#define TJ_NO_SANITIZE
+static inline int CountTrailingZeros(uint64_t v)
+{
+    unsigned long i;
+#if defined(_M_X64)
+    _BitScanForward64(&i, v);
+#else
+    if (!_BitScanForward(&i, (unsigned long)v)) {
+        _BitScanForward(&i, (unsigned long)(v >> 32));
+        i += 32;
+    }
+#endif
+    return (int)i;
+}
+#else
+#define TJ_TARGET(x)            __attribute__((target(x)))
+#define TJ_NO_SANITIZE          __attribute__((no_sanitize_address))
+static inline int CountTrailingZeros(uint64_t v)
+{
+    return __builtin_ctzll(v);
+}
+#endif
+
+// The nul-terminated scanners load whole aligned blocks and mask off the bytes before p, so
+// they never touch a page the string does not reach.
+
+TJ_TARGET("sse2") TJ_NO_SANITIZE
+static const char *SSE2SkipWhiteSpace(const char *p)
+{
+    const __m128i nine = _mm_set1_epi8(9);
+    const __m128i four = _mm_set1_epi8(4);
+    const __m128i space = _mm_set1_epi8(' ');
+    size_t misalign = (uintptr_t)p & 15;
+    const char *block = p - misalign;
+    uint32_t mask = (0xFFFFu << misalign) & 0xFFFFu;
+    for (;;) {
+        __m128i c = _mm_load_si128(reinterpret_cast<const __m128i *>(block));
+        __m128i t = _mm_sub_epi8(c, nine);
+        __m128i ws = _mm_or_si128(_mm_cmpeq_epi8(_mm_min_epu8(t, four), t), _mm_cmpeq_epi8(c, space));
+        uint32_t stop = ~(uint32_t)_mm_movemask_epi8(ws) & mask;
+        if (stop != 0) {
+            return block + CountTrailingZeros(stop);
+        }
+        block += 16;
+        mask = 0xFFFFu;
+    }
+}
+
+TJ_TARGET("sse2") TJ_NO_SANITIZE
+static const char *SSE2ScanString(const char *p)
+{
+    const __m128i quote = _mm_set1_epi8('\"');
+    const __m128i backslash = _mm_set1_epi8('\\');
+    const __m128i zero = _mm_setzero_si128();
+    size_t misalign = (uintptr_t)p & 15;
+    const char *block = p - misalign;
+    uint32_t mask = (0xFFFFu << misalign) & 0xFFFFu;
+    for (;;) {
+        __m128i c = _mm_load_si128(reinterpret_cast<const __m128i *>(block));
+        __m128i hit = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(c, quote), _mm_cmpeq_epi8(c, backslash)),
+            _mm_cmpeq_epi8(c, zero));
+        uint32_t stop = (uint32_t)_mm_movemask_epi8(hit) & mask;
+        if (stop != 0) {
+            return block + CountTrailingZeros(stop);
+        }
+        block += 16;
+        mask = 0xFFFFu;
+    }
+}
+
+TJ_TARGET("sse2")
+static bool SSE2ValidateUTF8(const char *p, size_t len)
+{
+    const unsigned char *s = reinterpret_cast<const unsigned char *>(p);
+    size_t i = 0;
+    while (i < len) {
+        if (i + 16 <= len && _mm_movemask_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(s + i))) == 0) {
+            i += 16;
+            continue;
+        }
+        size_t n = UTF8SequenceLength(s + i, len - i);
+        if (n == 0) {
+            return false;
+        }
+        i += n;
+    }
+    return true;
+}
+
+TJ_TARGET("sse2")
+static size_t SSE2IndexStructurals(const char *p, size_t len, uint32_t *out)
+{
+    const char chars[] = "{}[]:,\"\\";
+    __m128i needles[8];
+    for (int k = 0; k < 8; ++k) {
+        needles[k] = _mm_set1_epi8(chars[k]);
+    }
+    size_t count = 0;
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + i));
+        __m128i hit = _mm_cmpeq_epi8(c, needles[0]);
+        for (int k = 1; k < 8; ++k) {
+            hit = _mm_or_si128(hit, _mm_cmpeq_epi8(c, needles[k]));
+        }
+        for (uint32_t m = (uint32_t)_mm_movemask_epi8(hit); m != 0; m &= m - 1) {
+            out[count++] = (uint32_t)(i + CountTrailingZeros(m));
+        }
+    }
+    return IndexStructuralsFrom(p, i, len, out, count);
+}
+
+// PCMPESTRI takes explicit lengths, so it needs unaligned loads; near the end of a page it
+// steps one byte at a time instead so the load cannot fault.
+static inline bool NearPageEnd(const char *p)
+{
+    return ((uintptr_t)p & 4095) > 4096 - 16;
+}
+
+// CleanRun reads node strings, which carry no padding: only whole blocks inside [p, p + len) are
+// loaded and the tail is left to the narrower kernel.
+TJ_TARGET("sse2")
+static size_t SSE2CleanRun(const char *p, size_t len, bool asciiOnly)
+{
+    const __m128i quote = _mm_set1_epi8('\"');
+    const __m128i backslash = _mm_set1_epi8('\\');
+    const __m128i control = _mm_set1_epi8(0x1F);
+    const uint32_t high = asciiOnly ? 0xFFFFu : 0;
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + i));
+        __m128i hit = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(c, quote), _mm_cmpeq_epi8(c, backslash)),
+            _mm_cmpeq_epi8(_mm_max_epu8(c, control), control));
+        uint32_t stop = (uint32_t)_mm_movemask_epi8(hit) | ((uint32_t)_mm_movemask_epi8(c) & high);
+        if (stop != 0) {
+            return i + CountTrailingZeros(stop);
+        }
+    }
+    return i + JsonUtil::CleanRun(p + i, len - i, asciiOnly);
+}
+
+TJ_TARGET("sse4.2") TJ_NO_SANITIZE
+static const char *SSE42SkipWhiteSpace(const char *p)
+{
+    const __m128i ws = _mm_setr_epi8(' ', '\t', '\n', '\v', '\f', '\r', 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+    for (;;) {
+        if (NearPageEnd(p)) {
+            if (!JsonUtil::IsWhiteSpace(*p)) {
+                return p;
+            }
+            ++p;
+            continue;
+        }
+        __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+        int i = _mm_cmpestri(ws, 6, c, 16, _SIDD_UBYTE_OPS | _SIDD_CMP_EQUAL_ANY | _SIDD_NEGATIVE_POLARITY);
+        if (i < 16) {
+            return p + i;
+        }
+        p += 16;
+    }
+}
+
+TJ_TARGET("sse4.2") TJ_NO_SANITIZE
+static const char *SSE42ScanString(const char *p)
+{
+    const __m128i specials = _mm_setr_epi8('\"', '\\', 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+    for (;;) {
+        if (NearPageEnd(p)) {
+            if (*p == '\"' || *p == '\\' || !*p) {
+                return p;
+            }
+            ++p;
+            continue;
+        }
+        __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+        int i = _mm_cmpestri(specials, 3, c, 16, _SIDD_UBYTE_OPS | _SIDD_CMP_EQUAL_ANY);
+        if (i < 16) {
+            return p + i;
+        }
+        p += 16;
+    }
+}
+
+TJ_TARGET("sse4.2")
+static size_t SSE42IndexStructurals(const char *p, size_t len, uint32_t *out)
+{
+    const __m128i chars = _mm_setr_epi8('{', '}', '[', ']', ':', ',', '\"', '\\', 0, 0, 0, 0, 0, 0, 0, 0);
+    size_t count = 0;
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + i));
+        __m128i hit = _mm_cmpestrm(chars, 8, c, 16, _SIDD_UBYTE_OPS | _SIDD_CMP_EQUAL_ANY | _SIDD_BIT_MASK);
+        for (uint32_t m = (uint32_t)_mm_cvtsi128_si32(hit); m != 0; m &= m - 1) {
+            out[count++] = (uint32_t)(i + CountTrailingZeros(m));
+        }
+    }
+    return IndexStructuralsFrom(p, i, len, out, count);
+}
+
+TJ_TARGET("avx2") TJ_NO_SANITIZE
+static const char *AVX2SkipWhiteSpace(const char *p)
+{
+    const __m256i nine = _mm256_set1_epi8(9);
+    const __m256i four = _mm256_set1_epi8(4);
+    const __m256i space = _mm256_set1_epi8(' ');
+    size_t misalign = (uintptr_t)p & 31;
+    const char *block = p - misalign;
+    uint32_t mask = 0xFFFFFFFFu << misalign;
+    for (;;) {
+        __m256i c = _mm256_load_si256(reinterpret_cast<const __m256i *>(block));
+        __m256i t = _mm256_sub_epi8(c, nine);
+        __m256i ws = _mm256_or_si256(_mm256_cmpeq_epi8(_mm256_min_epu8(t, four), t), _mm256_cmpeq_epi8(c, space));
+        uint32_t stop = ~(uint32_t)_mm256_movemask_epi8(ws) & mask;
+        if (stop != 0) {
+            return block + CountTrailingZeros(stop);
+        }
+        block += 32;
+        mask = 0xFFFFFFFFu;
+    }
+}
+
+TJ_TARGET("avx2") TJ_NO_SANITIZE
+static const char *AVX2ScanString(const char *p)
+{
+    const __m256i quote = _mm256_set1_epi8('\"');
+    const __m256i backslash = _mm256_set1_epi8('\\');
+    const __m256i zero = _mm256_setzero_si256();
+    size_t misalign = (uintptr_t)p & 31;
+    const char *block = p - misalign;
+    uint32_t mask = 0xFFFFFFFFu << misalign;
+    for (;;) {
+        __m256i c = _mm256_load_si256(reinterpret_cast<const __m256i *>(block));
+        __m256i hit = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(c, quote), _mm256_cmpeq_epi8(c, backslash)),
+            _mm256_cmpeq_epi8(c, zero));
+        uint32_t stop = (uint32_t)_mm256_movemask_epi8(hit) & mask;
+        if (stop != 0) {
+            return block + CountTrailingZeros(stop);
+        }
+        block += 32;
+        mask = 0xFFFFFFFFu;
+    }
+}
+
+TJ_TARGET("avx2")
+static size_t AVX2CleanRun(const char *p, size_t len, bool asciiOnly)
+{
+    const __m256i quote = _mm256_set1_epi8('\"');
+    const __m256i backslash = _mm256_set1_epi8('\\');
+    const __m256i control = _mm256_set1_epi8(0x1F);
+    const uint32_t high = asciiOnly ? 0xFFFFFFFFu : 0;
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32) {
+        __m256i c = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p + i));
+        __m256i hit = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(c, quote), _mm256_cmpeq_epi8(c, backslash)),
+            _mm256_cmpeq_epi8(_mm256_max_epu8(c, control), control));
+        uint32_t stop = (uint32_t)_mm256_movemask_epi8(hit) | ((uint32_t)_mm256_movemask_epi8(c) & high);
+        if (stop != 0) {
+            return i + CountTrailingZeros(stop);
+        }
+    }
+    return i + SSE2CleanRun(p + i, len - i, asciiOnly);
+}
+
+TJ_TARGET("avx2")
+static bool AVX2ValidateUTF8(const char *p, size_t len)
+{
+    const unsigned char *s = reinterpret_cast<const unsigned char *>(p);
+    size_t i = 0;
+    while (i < len) {
+        if (i + 32 <= len && _mm256_movemask_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(s + i))) == 0) {
+            i += 32;
+            continue;
+        }
+        size_t n = UTF8SequenceLength(s + i, len - i);
+        if (n == 0) {
+            return false;
+        }
+        i += n;
+    }
+    return true;
+}
+
+TJ_TARGET("avx2")
+static size_t AVX2IndexStructurals(const char *p, size_t len, uint32_t *out)
+{
+    const char chars[] = "{}[]:,\"\\";
+    __m256i needles[8];
+    for (int k = 0; k < 8; ++k) {
+        needles[k] = _mm256_set1_epi8(chars[k]);
+    }
+    size_t count = 0;
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32) {
+        __m256i c = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p + i));
+        __m256i hit = _mm256_cmpeq_epi8(c, needles[0]);
+        for (int k = 1; k < 8; ++k) {
+            hit = _mm256_or_si256(hit, _mm256_cmpeq_epi8(c, needles[k]));
+        }
+        for (uint32_t m = (uint32_t)_mm256_movemask_epi8(hit); m != 0; m &= m - 1) {
+            out[count++] = (uint32_t)(i + CountTrailingZeros(m));
+        }
+    }
+    return IndexStructuralsFrom(p, i, len, out, count);
+}
+
+TJ_TARGET("avx512f,avx512bw") TJ_NO_SANITIZE
+static const char *AVX512SkipWhiteSpace(const char *p)
+{
+    const __m512i nine = _mm512_set1_epi8(9);
+    const __m512i four = _mm512_set1_epi8(4);
+    const __m512i space = _mm512_set1_epi8(' ');
+    size_t misalign = (uintptr_t)p & 63;
+    const char *block = p - misalign;
+    uint64_t mask = ~0ull << misalign;
+    for (;;) {
+        __m512i c = _mm512_load_si512(reinterpret_cast<const void *>(block));
+        uint64_t ws = _mm512_cmple_epu8_mask(_mm512_sub_epi8(c, nine), four) | _mm512_cmpeq_epi8_mask(c, space);
+        uint64_t stop = ~ws & mask;
+        if (stop != 0) {
+            return block + CountTrailingZeros(stop);
+        }
+        block += 64;
+        mask = ~0ull;
+    }
+}
+
+TJ_TARGET("avx512f,avx512bw") TJ_NO_SANITIZE
+static const char *AVX512ScanString(const char *p)
+{
+    const __m512i quote = _mm512_set1_epi8('\"');
+    const __m512i backslash = _mm512_set1_epi8('\\');
+    size_t misalign = (uintptr_t)p & 63;
+    const char *block = p - misalign;
+    uint64_t mask = ~0ull << misalign;
+    for (;;) {
+        __m512i c = _mm512_load_si512(reinterpret_cast<const void *>(block));
+        uint64_t hit = _mm512_cmpeq_epi8_mask(c, quote) | _mm512_cmpeq_epi8_mask(c, backslash)
+            | _mm512_testn_epi8_mask(c, c);
+        uint64_t stop = hit & mask;
+        if (stop != 0) {
+            return block + CountTrailingZeros(stop);
+        }
+        block += 64;
+        mask = ~0ull;
+    }
+}
+
+TJ_TARGET("avx512f,avx512bw")
+static size_t AVX512CleanRun(const char *p, size_t len, bool asciiOnly)
+{
+    const __m512i quote = _mm512_set1_epi8('\"');
+    const __m512i backslash = _mm512_set1_epi8('\\');
+    const __m512i control = _mm512_set1_epi8(0x20);
+    const uint64_t high = asciiOnly ? ~0ull : 0;
+    size_t i = 0;
+    for (; i + 64 <= len; i += 64) {
+        __m512i c = _mm512_loadu_si512(reinterpret_cast<const void *>(p + i));
+        uint64_t stop = _mm512_cmpeq_epi8_mask(c, quote) | _mm512_cmpeq_epi8_mask(c, backslash)
+            | _mm512_cmplt_epu8_mask(c, control) | (_mm512_movepi8_mask(c) & high);
+        if (stop != 0) {
+            return i + CountTrailingZeros(stop);
+        }
+    }
+    return i + AVX2CleanRun(p + i, len - i, asciiOnly);
+}
+
+TJ_TARGET("avx512f,avx512bw")
+static bool AVX512ValidateUTF8(const char *p, size_t len)
+{
+    const unsigned char *s = reinterpret_cast<const unsigned char *>(p);
+    size_t i = 0;
+    while (i < len) {
+        if (i + 64 <= len && _mm512_movepi8_mask(_mm512_loadu_si512(reinterpret_cast<const void *>(s + i))) == 0) {
+            i += 64;
+            continue;
+        }
+        size_t n = UTF8SequenceLength(s + i, len - i);
+        if (n == 0) {
+            return false;
+        }
+        i += n;
+    }
+    return true;
+}
+
+TJ_TARGET("avx512f,avx512bw")
+static size_t AVX512IndexStructurals(const char *p, size_t len, uint32_t *out)
+{
+    const char chars[] = "{}[]:,\"\\";
+    __m512i needles[8];
+    for (int k = 0; k < 8; ++k) {
+        needles[k] = _mm512_set1_epi8(chars[k]);
+    }
+    size_t count = 0;
+    size_t i = 0;
+    for (; i + 64 <= len; i += 64) {
+        __m512i c = _mm512_loadu_si512(reinterpret_cast<const void *>(p + i));
+        uint64_t m = 0;
+        for (int k = 0; k < 8; ++k) {
+            m |= _mm512_cmpeq_epi8_mask(c, needles[k]);
+        }
+        for (; m != 0; m &= m - 1) {
+            out[count++] = (uint32_t)(i + CountTrailingZeros(m));
+        }
+    }
+    return IndexStructuralsFrom(p, i, len, out, count);
+}
+#endif // x86
+
+static const JsonKernels kernelSets[] = {
+    { JsonKernels::Level::SCALAR, "scalar",
+        static_cast<const char *(*)(const char *)>(&JsonUtil::SkipWhiteSpace), &JsonUtil::ScanString,
+        &JsonUtil::IsValidUTF8, &JsonUtil::IndexStructurals, &JsonUtil::CleanRun },
+#ifdef TJ_X86
+    { JsonKernels::Level::SSE2, "sse2",
+        &SSE2SkipWhiteSpace, &SSE2ScanString, &SSE2ValidateUTF8, &SSE2IndexStructurals, &SSE2CleanRun },
+    { JsonKernels::Level::SSE42, "sse42",
+        &SSE42SkipWhiteSpace, &SSE42ScanString, &SSE2ValidateUTF8, &SSE42IndexStructurals,
+        &SSE2CleanRun },
+    { JsonKernels::Level::AVX2, "avx2",
+        &AVX2SkipWhiteSpace, &AVX2ScanString, &AVX2ValidateUTF8, &AVX2IndexStructurals, &AVX2CleanRun },
+    { JsonKernels::Level::AVX512, "avx512",
+        &AVX512SkipWhiteSpace, &AVX512ScanString, &AVX512ValidateUTF8, &AVX512IndexStructurals,
+        &AVX512CleanRun },
+#endif
+};
+
+std::atomic<const JsonKernels *> JsonKernels::_active(nullptr);
+
+JsonKernels::Level JsonKernels::Detect()
+{
+#if defined(TJ_X86) && defined(_MSC_VER) && !defined(__clang__)
+    int info[4];
+    __cpuid(info, 0);
+    int maxLeaf = info[0];
+    __cpuid(info, 1);
+    bool sse2 = (info[3] & (1 << 26)) != 0;
+    bool sse42 = (info[2] & (1 << 20)) != 0;
+    bool osxsave = (info[2] & (1 << 27)) != 0;
+    unsigned long long xcr0 = osxsave ? _xgetbv(0) : 0;
+    bool avx2 = false;
+    bool avx512 = false;
+    if (maxLeaf >= 7 && (xcr0 & 0x6) == 0x6) {
+        __cpuidex(info, 7, 0);
+        avx2 = (info[1] & (1 << 5)) != 0;
+        avx512 = (xcr0 & 0xE6) == 0xE6 && (info[1] & (1 << 16)) != 0 && (info[1] & (1 << 30)) != 0;
+    }
+#elif defined(TJ_X86)
+    __builtin_cpu_init();
+    bool sse2 = __builtin_cpu_supports("sse2");
+    bool sse42 = __builtin_cpu_supports("sse4.2");
+    bool avx2 = __builtin_cpu_supports("avx2");
+    bool avx512 = __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw");
+#endif
+#ifdef TJ_X86
+    if (avx512) {
+        return Level::AVX512;
+    }
+    if (avx2) {
+        return Level::AVX2;
+    }
+    if (sse42) {
+        return Level::SSE42;
+    }
+    if (sse2) {
+        return Level::SSE2;
+    }
+#endif
+    return Level::SCALAR;
+}
+
+const JsonKernels *JsonKernels::Find(Level level)
+{
+    for (size_t i = 0; i < sizeof(kernelSets) / sizeof(kernelSets[0]); ++i) {
+        if (kernelSets[i].level == level) {
+            return &kernelSets[i];
+        }
+    }
+    return nullptr;
+}
+
+static const JsonKernels *FindSupported(const char *name)
+{
+    if (name == nullptr || !strcmp(name, "auto")) {
+        return JsonKernels::Find(JsonKernels::Detect());
+    }
+    for (size_t i = 0; i < sizeof(kernelSets) / sizeof(kernelSets[0]); ++i) {
+        if (!strcmp(kernelSets[i].name, name)) {
+            return kernelSets[i].level <= JsonKernels::Detect() ? &kernelSets[i] : nullptr;
+        }
+    }
+    return nullptr;
+}
+
+bool JsonKernels::Force(const char *name)
+{
+    const JsonKernels *kernels = FindSupported(name);
+    if (kernels == nullptr) {
+        return false;
+    }
+    _active.store(kernels, std::memory_order_release);
+    return true;
+}
+
+const JsonKernels &JsonKernels::Init()
+{
+    const JsonKernels *kernels = FindSupported(getenv("TINYJSON_KERNEL"));
+    if (kernels == nullptr) {
+        kernels = Find(Detect());
+    }
+    const JsonKernels *expected = nullptr;
+    _active.compare_exchange_strong(expected, kernels, std::memory_order_acq_rel);
+    return *_active.load(std::memory_order_acquire);
+}
+
+/********************************************************************************************/
+
+JsonValue JsonValue::FromNode(const JsonNode *node)
+{
+    if (node->ToNumber() != nullptr) {
+        return Double(node->ToNumber()->GetDouble());
+    }
+    if (node->ToReserved() != nullptr) {
+        switch (node->ToReserved()->GetType()) {
+        case JsonReserved::Type::RESERVED_TRUE:
+            return Bool(true);
+        case JsonReserved::Type::RESERVED_FALSE:
+            return Bool(false);
+        default:
+            return Null();
+        }
+    }
+    return Node(node);
+}
+
+/********************************************************************************************/
+
+// JsonUtil::SkipWhiteSpace through the selected kernel, for the parser's nul-terminated buffer.
+// Most tokens follow no whitespace at all, so the first byte is checked before the call.
+static inline char *SkipSpace(char *p)
+{
+    if (p == nullptr || !JsonUtil::IsWhiteSpace(*p)) {
+        return p;
+    }
+    return const_cast<char *>(JsonKernels::Get().skipWhiteSpace(p));
+}
+
 JsonNode::JsonNode(JsonDocument *doc) :
     _document(doc),
     _parent(nullptr),
@@ -11,555 +1078,2503 @@ JsonNode::JsonNode(JsonDocument *doc) :
     _lastChild(nullptr),
     _next(nullptr),
     _prev(nullptr),
-    _memPool(nullptr)
+    _memPool(nullptr),
+    _lazy(nullptr)
+{
+}
+
+JsonNode::~JsonNode()
+{
+    DeleteChildren();
+    if (_parent != nullptr) {
+        _parent->Unlink(this);
+    }
+}
+
+void JsonNode::DeleteChildren()
+{
+    while (_firstChild != nullptr) {
+        JsonNode *node = _firstChild;
+        Unlink(node);
+
+        DeleteNode(node);
+    }
+    _firstChild = _lastChild = nullptr;
+    _lazy = nullptr;
+    // Not from ~JsonNode, where the document's own members are already gone.
+    if (JsonDocument *document = ToDocument()) {
+        // The batch roots were among the children, and the arena nodes are gone too.
+        document->_batch.Clear();
+        document->ReleaseArenas();
+    }
+}
+
+// Where a lazy container that failed to parse points, so it keeps failing: the input it was
+// parsing in place can't be parsed again.
+static char lazyFailed;
+
+bool JsonNode::Materialize() const
+{
+    JsonNode *self = const_cast<JsonNode *>(this);
+    char *json = self->_lazy;
+    if (json == &lazyFailed) {
+        return false;
+    }
+    self->_lazy = nullptr;
+    if (self->ParseContent(json) != nullptr) {
+        return true;
+    }
+    // Drop the children parsed before the error rather than show part of the container.
+    self->DeleteChildren();
+    self->_lazy = &lazyFailed;
+    return false;
+}
+
+bool JsonNode::MaterializeAll() const
+{
+    if (!EnsureParsed()) {
+        return false;
+    }
+    for (const JsonNode *node = _firstChild; node; node = node->NextSibling()) {
+        if (!node->MaterializeAll()) {
+            return false;
+        }
+    }
+    return true;
+}
+
+char *JsonNode::ParseLazy(char *json)
+{
+    char *end = JsonUtil::SkipContainer(json);
+    if (end != nullptr) {
+        _lazy = json;
+        _document->_hasLazyContent = true;
+    }
+    return end;
+}
+
+
+void JsonNode::Unlink(JsonNode *child)
+{
+    TJASSERT(child->_parent == this);
+    if (JsonObject *object = ToObject()) {
+        object->Unfreeze();
+    }
+    if (child == _firstChild) {
+        _firstChild = _firstChild->_next;
+    }
+    if (child == _lastChild) {
+        _lastChild = _lastChild->_prev;
+    }
+
+    if (child->_prev != nullptr) {
+        child->_prev->_next = child->_next;
+    }
+    if (child->_next != nullptr) {
+        child->_next->_prev = child->_prev;
+    }
+    child->_parent = nullptr;
+}
+
+JsonNode *JsonNode::InsertEndChild(JsonNode *node)
+{
+    if (_lazy != nullptr) {
+        Materialize();
+    }
+    if (JsonObject *object = ToObject()) {
+        object->Unfreeze();
+    }
+    if (_lastChild) {
+        TJASSERT(_firstChild);
+        TJASSERT(_lastChild->_next == 0);
+        _lastChild->_next = node;
+        node->_prev = _lastChild;
+        _lastChild = node;
+
+        node->_next = 0;
+    }
+    else {
+        TJASSERT(_firstChild == 0);
+        _firstChild = _lastChild = node;
+
+        node->_prev = 0;
+        node->_next = 0;
+    }
+    node->_parent = this;
+#ifdef DEBUG
+    node->_memPool->SetTracked();
+#endif // DEBUG
+
+    return node;
+}
+
+char *JsonNode::ParseDeep(char *json)
+{
+    while (json != nullptr && *json) {
+        JsonNode *node = nullptr;
+
+        json = _document->Identify(json, &node);
+        if (json == nullptr || node == nullptr) {
+            break;
+        }
+
+        json = SkipSpace(node->ParseDeep(json));
+        if (json == nullptr) {
+#ifdef DEBUG
+            node->GetMemPool()->SetTracked();
+#endif
+            DeleteNode(node);
+            node = nullptr;
+            _document->SetError(JsonError::JSON_ERROR_PARSING, 0, 0);
+            break;
+        }
+
+        if (node != nullptr) {
+            this->InsertEndChild(node);
+        }
+    }
+    return json;
+}
+
+static bool VisitEnterNode(JsonVisitor *visitor, const JsonNode *node)
+{
+    if (node->ToObject() != nullptr) {
+        return visitor->VisitEnter(*node->ToObject());
+    }
+    if (node->ToArray() != nullptr) {
+        return visitor->VisitEnter(*node->ToArray());
+    }
+    if (node->ToElement() != nullptr) {
+        return visitor->VisitEnter(*node->ToElement());
+    }
+    return true;
+}
+
+static void VisitExitNode(JsonVisitor *visitor, const JsonNode *node)
+{
+    if (node->ToObject() != nullptr) {
+        visitor->VisitExit(*node->ToObject());
+    } else if (node->ToArray() != nullptr) {
+        visitor->VisitExit(*node->ToArray());
+    } else if (node->ToElement() != nullptr) {
+        visitor->VisitExit(*node->ToElement());
+    }
+}
+
+bool JsonNode::ParallelAccept(JsonVisitorFactory *factory, JsonThreadPool *pool, int minChildren) const
+{
+    // Materializing allocates from the document's pools, so it can't happen on the workers.
+    if (_document->HasLazyContent() && !MaterializeAll()) {
+        return false;
+    }
+    const JsonNode *container = this;
+    if (_document == this && _firstChild != nullptr && _firstChild == _lastChild) {
+        container = _firstChild;
+    }
+
+    DynArray< const JsonNode *, 64 > children;
+    for (const JsonNode *node = container->FirstChild(); node; node = node->NextSibling()) {
+        children.Push(node);
+    }
+
+    if (pool == nullptr || children.Size() < minChildren || children.Size() < 2) {
+        JsonVisitor *visitor = factory->Create();
+        Accept(visitor);
+        factory->Reduce(visitor);
+        factory->Destroy(visitor);
+        return true;
+    }
+
+    // A few ranges per thread, claimed dynamically, so uneven subtrees still balance out.
+    int rangeCount = pool->ThreadCount() * 4;
+    if (rangeCount > children.Size()) {
+        rangeCount = children.Size();
+    }
+    JsonVisitor **visitors = new JsonVisitor *[rangeCount];
+    const bool isContainer = container != this || _document != this;
+    bool enter = true;
+
+    visitors[0] = factory->Create();
+    if (isContainer) {
+        enter = VisitEnterNode(visitors[0], container);
+    }
+    if (enter) {
+        pool->ParallelFor(rangeCount, [&](int, int range) {
+            int begin = (int)((long long)children.Size() * range / rangeCount);
+            int end = (int)((long long)children.Size() * (range + 1) / rangeCount);
+            if (range != 0) {
+                visitors[range] = factory->Create();
+            }
+            for (int i = begin; i < end; ++i) {
+                if (!children[i]->Accept(visitors[range])) {
+                    break;
+                }
+            }
+        });
+    } else {
+        rangeCount = 1;
+    }
+    if (isContainer) {
+        VisitExitNode(visitors[rangeCount - 1], container);
+    }
+
+    for (int i = 0; i < rangeCount; ++i) {
+        factory->Reduce(visitors[i]);
+        factory->Destroy(visitors[i]);
+    }
+    delete[] visitors;
+    return true;
+}
+
+/********************************************************************************************/
+JsonReserved::JsonReserved(JsonDocument *doc) : JsonNode(doc),
+    _type(JsonReserved::Type::RESERVED)
+{}
+
+JsonReserved::~JsonReserved()
+{}
+
+char *JsonReserved::ParseDeep(char *json)
+{
+    if (!strncmp(json, "null", 4)) {
+        _type = JsonReserved::Type::RESERVED_NULL;
+        json += 4;
+    } else if (!strncmp(json, "true", 4)) {
+        _type = JsonReserved::Type::RESERVED_TRUE;
+        json += 4;
+    } else if (!strncmp(json, "false", 5)) {
+        _type = JsonReserved::Type::RESERVED_FALSE;
+        json += 5;
+    } else {
+        _document->SetError(JsonError::JSON_ERROR_PARSING_RESERVED, 0, 0);
+        json = nullptr;
+    }
+
+    return json;
+}
+
+bool JsonReserved::Accept(JsonVisitor *visitor) const
+{
+    return visitor->Visit(*this);
+}
+
+JsonNumber::JsonNumber(JsonDocument *doc) : JsonNode(doc),
+    _valueInt(0),
+    _isInt(true)
+{
+}
+
+JsonNumber::~JsonNumber()
+{
+}
+
+int64_t JsonNumber::GetInt64() const
+{
+    if (_isInt) {
+        return _valueInt;
+    }
+    if (_valueDouble != _valueDouble) {
+        return 0;
+    }
+    if (_valueDouble >= 9223372036854775808.0) {
+        return INT64_MAX;
+    }
+    if (_valueDouble <= -9223372036854775808.0) {
+        return INT64_MIN;
+    }
+    return (int64_t)_valueDouble;
+}
+
+void JsonNumber::SetInt(int64_t value)
+{
+    _valueInt = value;
+    _isInt = true;
+}
+
+void JsonNumber::SetDouble(double value)
+{
+    _valueDouble = value;
+    _isInt = false;
+}
+
+char *JsonNumber::ParseDeep(char *json)
+{
+    char *endptr;
+    json = SkipSpace(json);
+    if (json == nullptr) {
+        return nullptr;
+    }
+
+    bool isInt;
+    int64_t intValue;
+    double doubleValue;
+    const char *end = JsonUtil::ParseNumber(json, &isInt, &intValue, &doubleValue);
+    // Where strtod would read on (leading zeros, hex, inf), it still decides, as it used to.
+    if (end != nullptr && !isalnum((unsigned char)*end) && *end != '.') {
+        if (isInt) {
+            SetInt(intValue);
+        } else {
+            SetDouble(doubleValue);
+        }
+        return const_cast<char *>(end);
+    }
+    double n = strtod(json, &endptr);
+    if (endptr != json) {
+        SetDouble(n);
+        return endptr;
+    }
+    _document->SetError(JsonError::JSON_ERROR_OBJECT_MISMATCH, 0, 0);
+
+    return nullptr;
+}
+
+bool JsonNumber::Accept(JsonVisitor *visitor) const
+{
+    return visitor->Visit(*this);
+}
+
+JsonString::JsonString(JsonDocument *doc) : JsonNode(doc)
+{
+}
+
+JsonString::~JsonString()
+{
+}
+
+char *JsonString::ParseDeep(char *json)
+{
+    const char *(*scanString)(const char *) = JsonKernels::Get().scanString;
+    char *ptr = json;
+    bool escaped = false;
+    for (;;) {
+        ptr = const_cast<char *>(scanString(ptr));
+        if (*ptr != '\\' || !ptr[1]) {
+            break;
+        }
+        escaped = true;
+        ptr += 2;
+    }
+    if (*ptr != '\"') {
+        _document->SetError(JsonError::JSON_ERROR_PARSING_STRING, 0, 0);
+        return nullptr;
+    }
+    // Escapes never grow when decoded, so the string is unescaped in place.
+    char *end = escaped ? JsonUtil::UnescapeString(json, ptr) : ptr;
+    if (end == nullptr) {
+        _document->SetError(JsonError::JSON_ERROR_PARSING_STRING, 0, 0);
+        return nullptr;
+    }
+    *end = 0;
+    if ((_document->_parseOptions & ParseOptions::DEDUP_STRINGS)
+            && (size_t)(end - json) <= JsonDocument::DEDUP_MAX_LENGTH) {
+        char *shared = const_cast<char *>(_document->InternString(json, end - json));
+        _str.Set(shared, shared + (end - json));
+    } else {
+        _str.Set(json, end);
+    }
+    json = ptr + 1;
+    return json;
+}
+
+bool JsonString::Accept(JsonVisitor *visitor) const
+{
+    return visitor->Visit(*this);
+}
+
+/********************************************************************************************/
+
+JsonElement::JsonElement(JsonDocument *doc) : JsonNode(doc)
+{
+}
+
+JsonElement::~JsonElement()
+{
+}
+
+char *JsonElement::ParseDeep(char *json)
+{
+    do{
+        if (*json != '\"') {
+            break;
+        }
+        //key
+        json = SkipSpace(JsonNode::ParseDeep(json));
+        if (json == nullptr || *json != ':') {
+            break;
+        }
+        ++json;
+        //value
+        json = SkipSpace(JsonNode::ParseDeep(json));
+        if (json == nullptr) {
+            break;
+        }
+        return json;
+    } while (false);
+
+    _document->SetError(JsonError::JSON_ERROR_PARSING_ELEMENT, 0, 0);
+    return nullptr;
+}
+
+bool JsonElement::Accept(JsonVisitor *visitor) const
+{
+    if (visitor->VisitEnter(*this)) {
+        for (const JsonNode *node = FirstChild(); node; node = node->NextSibling()) {
+            if (!node->Accept(visitor)) {
+                break;
+            }
+        }
+    }
+    return visitor->VisitExit(*this);
+}
+
+/********************************************************************************************/
+
+JsonObject::JsonObject(JsonDocument *doc) : JsonNode(doc), _members(nullptr), _memberCount(0)
+{
+}
+
+
+JsonObject::~JsonObject()
+{
+}
+
+char *JsonObject::ParseDeep(char *json)
+{
+    if (_document->GetParseOptions() & ParseOptions::LAZY) {
+        json = ParseLazy(json);
+        if (json == nullptr) {
+            _document->SetError(JsonError::JSON_ERROR_OBJECT_MISMATCH, 0, 0);
+        }
+        return json;
+    }
+    JsonDocument::DepthTracker depth(_document);
+    if (depth.Exceeded()) {
+        return nullptr;
+    }
+    return ParseContent(json);
+}
+
+char *JsonObject::ParseContent(char *json)
+{
+    json = SkipSpace(json);
+    if (json == nullptr || !*json) {
+        _document->SetError(JsonError::JSON_ERROR_OBJECT_MISMATCH, 0, 0);
+        return nullptr;
+    }
+
+    if (*json == '}') {
+        ++json;
+        return json;
+    }
+
+    json = ParseElement(json);
+    if (json == nullptr) {
+        return nullptr;
+    }
+
+    while (*json == ',') {
+        ++json;
+        json = ParseElement(json);
+        if (json == nullptr) {
+            _document->SetError(JsonError::JSON_ERROR_OBJECT_MISMATCH, 0, 0);
+            return nullptr;
+        }
+    }
+
+    if (*json == '}') {
+        ++json;
+        return json;
+    }
+
+    _document->SetError(JsonError::JSON_ERROR_OBJECT_MISMATCH, 0, 0);
+    return nullptr;
+}
+
+char *JsonObject::ParseElement(char *json) {
+    JsonElement *node = _document->CreatElement();
+    if (node == nullptr) {
+        return nullptr;
+    }
+    json = SkipSpace(node->ParseDeep(SkipSpace(json)));
+    if (json == nullptr) {
+#ifdef DEBUG
+        node->GetMemPool()->SetTracked();
+#endif
+        DeleteNode(node);
+        node = nullptr;
+        _document->SetError(JsonError::JSON_ERROR_PARSING_ELEMENT, 0, 0);
+        return nullptr;
+    }
+    InsertEndChild(node);
+    return json;
+}
+
+uint64_t JsonObject::KeyPrefix(const char *key, size_t len)
+{
+    uint64_t prefix = 0;
+    for (size_t i = 0; i < 8 && i < len; ++i) {
+        prefix |= (uint64_t)(unsigned char)key[i] << (56 - 8 * i);
+    }
+    return prefix;
+}
+
+// Orders like memcmp over the common length, then the shorter key first. The prefix settles
+// most comparisons in one integer compare.
+int JsonObject::CompareKey(const Member &member, uint64_t prefix, const char *key, size_t len)
+{
+    if (member.prefix != prefix) {
+        return member.prefix < prefix ? -1 : 1;
+    }
+    const JsonString *name = member.element->Key();
+    size_t nameLen = name->Length();
+    if (nameLen > 8 && len > 8) {
+        int cmp = memcmp(name->CStr() + 8, key + 8, (nameLen < len ? nameLen : len) - 8);
+        if (cmp != 0) {
+            return cmp;
+        }
+    }
+    return nameLen < len ? -1 : nameLen > len ? 1 : 0;
+}
+
+// Member array over the keyed children in their current order.
+void JsonObject::Index(MemArena *arena)
+{
+    int count = 0;
+    for (const JsonNode *node = _firstChild; node; node = node->_next) {
+        count += node->ToElement() != nullptr && node->ToElement()->Key() != nullptr;
+    }
+    Member *members = static_cast<Member *>(arena->Alloc(sizeof(Member) * (count + 1), alignof(Member)));
+    if (members == nullptr) {
+        return;
+    }
+    int i = 0;
+    for (const JsonNode *node = _firstChild; node; node = node->_next) {
+        const JsonElement *element = node->ToElement();
+        if (element != nullptr && element->Key() != nullptr) {
+            members[i].prefix = KeyPrefix(element->Key()->CStr(), element->Key()->Length());
+            members[i].element = element;
+            ++i;
+        }
+    }
+    _members = members;
+    _memberCount = count;
+}
+
+// Stays unfrozen if the arena is out of memory.
+void JsonObject::Freeze(MemArena *arena)
+{
+    Index(arena);
+    if (_members == nullptr) {
+        return;
+    }
+    std::stable_sort(_members, _members + _memberCount, [](const Member &a, const Member &b) {
+        const JsonString *key = b.element->Key();
+        return CompareKey(a, b.prefix, key->CStr(), key->Length()) < 0;
+    });
+
+    // Relink the keyed children in sorted order, anything else after them.
+    JsonNode *rest = nullptr;
+    JsonNode *restLast = nullptr;
+    for (JsonNode *node = _firstChild; node; ) {
+        JsonNode *next = node->_next;
+        if (node->ToElement() == nullptr || node->ToElement()->Key() == nullptr) {
+            node->_prev = restLast;
+            node->_next = nullptr;
+            if (restLast != nullptr) {
+                restLast->_next = node;
+            } else {
+                rest = node;
+            }
+            restLast = node;
+        }
+        node = next;
+    }
+    JsonNode *last = nullptr;
+    for (int i = 0; i < _memberCount; ++i) {
+        JsonNode *node = const_cast<JsonElement *>(_members[i].element);
+        node->_prev = last;
+        if (last != nullptr) {
+            last->_next = node;
+        } else {
+            _firstChild = node;
+        }
+        last = node;
+    }
+    if (last != nullptr) {
+        last->_next = rest;
+        if (rest != nullptr) {
+            rest->_prev = last;
+        }
+    } else {
+        _firstChild = rest;
+    }
+    _lastChild = restLast != nullptr ? restLast : last;
+}
+
+// First member not ordered before key.
+int JsonObject::LowerBound(uint64_t prefix, const char *key, size_t len) const
+{
+    int low = 0;
+    int high = _memberCount;
+    while (low < high) {
+        int mid = (low + high) / 2;
+        if (CompareKey(_members[mid], prefix, key, len) < 0) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+const JsonNode *JsonObject::Find(const char *key) const
+{
+    size_t len = strlen(key);
+    if (_members != nullptr) {
+        uint64_t prefix = KeyPrefix(key, len);
+        int low = LowerBound(prefix, key, len);
+        if (low < _memberCount && CompareKey(_members[low], prefix, key, len) == 0) {
+            return _members[low].element->Value();
+        }
+        return nullptr;
+    }
+    for (const JsonNode *node = FirstChild(); node; node = node->NextSibling()) {
+        const JsonElement *element = node->ToElement();
+        const JsonString *name = element != nullptr ? element->Key() : nullptr;
+        if (name != nullptr && name->Length() == len && !memcmp(name->CStr(), key, len)) {
+            return element->Value();
+        }
+    }
+    return nullptr;
+}
+
+JsonLookupCache::JsonLookupCache(const char *key) :
+    _key(key),
+    _length(strlen(key)),
+    _prefix(JsonObject::KeyPrefix(key, _length)),
+    _slot(0)
+{
+}
+
+// On a frozen object the slot indexes the member array. Otherwise it is the child position:
+// the walk to it remains, and only the child there has its key compared before the full walk.
+const JsonNode *JsonObject::Find(JsonLookupCache *cache) const
+{
+    const char *key = cache->_key;
+    size_t len = cache->_length;
+    if (_members != nullptr) {
+        int slot = cache->_slot;
+        if (slot < _memberCount && CompareKey(_members[slot], cache->_prefix, key, len) == 0
+                && (slot == 0 || CompareKey(_members[slot - 1], cache->_prefix, key, len) != 0)) {
+            return _members[slot].element->Value();
+        }
+        slot = LowerBound(cache->_prefix, key, len);
+        if (slot < _memberCount && CompareKey(_members[slot], cache->_prefix, key, len) == 0) {
+            cache->_slot = slot;
+            return _members[slot].element->Value();
+        }
+        return nullptr;
+    }
+
+    const JsonNode *node = FirstChild();
+    for (int i = 0; node != nullptr && i < cache->_slot; ++i) {
+        node = node->NextSibling();
+    }
+    const JsonElement *element = node != nullptr ? node->ToElement() : nullptr;
+    if (element != nullptr && element->Key() != nullptr && element->Key()->Length() == len
+            && !memcmp(element->Key()->CStr(), key, len)) {
+        return element->Value();
+    }
+
+    int slot = 0;
+    for (node = FirstChild(); node; node = node->NextSibling(), ++slot) {
+        element = node->ToElement();
+        const JsonString *name = element != nullptr ? element->Key() : nullptr;
+        if (name != nullptr && name->Length() == len && !memcmp(name->CStr(), key, len)) {
+            cache->_slot = slot;
+            return element->Value();
+        }
+    }
+    return nullptr;
+}
+
+bool JsonObject::Accept(JsonVisitor *visitor) const
+{
+    // A lazy container that fails to parse stops the walk.
+    if (!EnsureParsed()) {
+        return false;
+    }
+    if (visitor->VisitEnter(*this)) {
+        for (const JsonNode *node = FirstChild(); node; node = node->NextSibling()) {
+            if (!node->Accept(visitor)) {
+                break;
+            }
+        }
+    }
+    return visitor->VisitExit(*this);
+}
+/********************************************************************************************/
+
+JsonArray::JsonArray(JsonDocument *doc) : JsonNode(doc),
+    _packing(Packing::NONE),
+    _packedSize(0),
+    _packedData(nullptr)
+{
+}
+
+JsonArray::~JsonArray()
+{
+}
+
+char *JsonArray::ParseDeep(char *json)
+{
+    if (_document->GetParseOptions() & ParseOptions::LAZY) {
+        json = ParseLazy(json);
+        if (json == nullptr) {
+            _document->SetError(JsonError::JSON_ERROR_ARRAY_MISMATCH, 0, 0);
+        }
+        return json;
+    }
+    JsonDocument::DepthTracker depth(_document);
+    if (depth.Exceeded()) {
+        return nullptr;
+    }
+    return ParseContent(json);
+}
+
+char *JsonArray::ParseContent(char *json)
+{
+    json = SkipSpace(json);
+    if (json == nullptr || !*json) {
+        _document->SetError(JsonError::JSON_ERROR_ARRAY_MISMATCH, 0, 0);
+        return nullptr;
+    }
+
+    if (*json == ']') {
+        ++json;
+        return json;
+    }
+
+    if (_document->_parseOptions & (ParseOptions::PACK_NUMBERS | ParseOptions::PACK_SCALARS)) {
+        char *end = ParsePacked(json);
+        if (end != nullptr) {
+            return end;
+        }
+    }
+    
+    json = SkipSpace(JsonNode::ParseDeep(json));
+    if (json == nullptr) {
+        return nullptr;
+    }
+    while (*json == ',') {
+        ++json;
+        json = SkipSpace(JsonNode::ParseDeep(json));
+        if (json == nullptr || !*json) {
+            _document->SetError(JsonError::JSON_ERROR_ARRAY_MISMATCH, 0, 0);
+            return nullptr;
+        }
+    }
+    if (*json == ']') {
+        ++json;
+        return json;
+    }
+
+    _document->SetError(JsonError::JSON_ERROR_ARRAY_MISMATCH, 0, 0);
+    return nullptr;
+}
+
+// Returns null, having created nothing, as soon as the array turns out not to be a plain list
+// of numbers, so the caller can parse it the normal way. That includes integers a double can't
+// hold exactly outside an all-integer array, which JsonNumber nodes keep exactly.
+char *JsonArray::ParsePacked(char *json)
+{
+    DynArray< int64_t, 64 > &ints = _document->_packInts;
+    DynArray< double, 64 > &doubles = _document->_packDoubles;
+    DynArray< JsonValue, 64 > &values = _document->_packValues;
+    ints.Clear();
+    doubles.Clear();
+    values.Clear();
+
+    const bool scalars = (_document->_parseOptions & ParseOptions::PACK_SCALARS) != 0;
+    bool allInts = true;
+    bool allNumbers = true;
+    bool wideInts = false;
+    for (;;) {
+        bool isInt;
+        int64_t intValue;
+        double doubleValue;
+        const char *end = JsonUtil::ParseNumber(json, &isInt, &intValue, &doubleValue);
+        if (end != nullptr) {
+            allInts = allInts && isInt;
+            // doubleValue is intValue rounded; 2^63 itself would not convert back.
+            wideInts = wideInts || (isInt && !(doubleValue < 9223372036854775808.0 && (int64_t)doubleValue == intValue));
+            ints.Push(intValue);
+            doubles.Push(doubleValue);
+            values.Push(isInt ? JsonValue::Number(intValue) : JsonValue::Double(doubleValue));
+        } else if (scalars && !strncmp(json, "null", 4)) {
+            end = json + 4;
+            values.Push(JsonValue::Null());
+        } else if (scalars && !strncmp(json, "true", 4)) {
+            end = json + 4;
+            values.Push(JsonValue::Bool(true));
+        } else if (scalars && !strncmp(json, "false", 5)) {
+            end = json + 5;
+            values.Push(JsonValue::Bool(false));
+        } else {
+            return nullptr;
+        }
+        allNumbers = allNumbers && values.Size() == ints.Size();
+
+        json = SkipSpace(const_cast<char *>(end));
+        if (*json == ']') {
+            break;
+        }
+        if (*json != ',') {
+            return nullptr;
+        }
+        json = SkipSpace(json + 1);
+    }
+
+    if (wideInts && !(allNumbers && allInts)) {
+        return nullptr;
+    }
+
+    _packedSize = values.Size();
+    if (!allNumbers) {
+        _packing = Packing::PACKED_VALUE;
+        _packedData = _document->_blobArena.Alloc(sizeof(JsonValue) * _packedSize, sizeof(JsonValue));
+        memcpy(_packedData, values.Mem(), sizeof(JsonValue) * _packedSize);
+    } else if (allInts) {
+        _packing = Packing::PACKED_INT64;
+        _packedData = _document->_blobArena.Alloc(sizeof(int64_t) * _packedSize, sizeof(int64_t));
+        memcpy(_packedData, ints.Mem(), sizeof(int64_t) * _packedSize);
+    } else {
+        _packing = Packing::PACKED_DOUBLE;
+        _packedData = _document->_blobArena.Alloc(sizeof(double) * _packedSize, sizeof(double));
+        memcpy(_packedData, doubles.Mem(), sizeof(double) * _packedSize);
+    }
+    return json + 1;
+}
+
+const JsonNode *JsonArray::At(int index) const
+{
+    if (index < 0) {
+        return nullptr;
+    }
+    const JsonNode *node = FirstChild();
+    for (; node != nullptr && index > 0; --index) {
+        node = node->NextSibling();
+    }
+    return node;
+}
+
+JsonValue JsonArray::PackedAt(int i) const
+{
+    TJASSERT(i >= 0 && i < _packedSize);
+    switch (_packing) {
+    case Packing::PACKED_INT64:
+        return JsonValue::Number(AsInt64Span()[i]);
+    case Packing::PACKED_DOUBLE:
+        return JsonValue::Double(AsDoubleSpan()[i]);
+    case Packing::PACKED_VALUE:
+        return AsValueSpan()[i];
+    default:
+        return JsonValue::Null();
+    }
+}
+
+bool JsonArray::Accept(JsonVisitor *visitor) const
+{
+    // A lazy container that fails to parse stops the walk.
+    if (!EnsureParsed()) {
+        return false;
+    }
+    if (visitor->VisitEnter(*this)) {
+        for (const JsonNode *node = FirstChild(); node; node = node->NextSibling()) {
+            if (!node->Accept(visitor)) {
+                break;
+            }
+        }
+    }
+    return visitor->VisitExit(*this);
+}
+/********************************************************************************************/
+JsonDocument::JsonDocument(unsigned parseOptions) :
+    JsonNode(nullptr),
+    _errorID(JsonError::JSON_NO_ERROR),
+    _errorStr1(nullptr),
+    _errorStr2(nullptr),
+    _charBuffer(nullptr),
+    _charBufferSize(0),
+    _parseDepth(0),
+    _hasLazyContent(false),
+    _parseOptions(parseOptions),
+    _strTable(&_blobArena)
+{
+    _document = this;
+}
+
+JsonDocument::~JsonDocument()
+{
+    DeleteChildren();
+    if (_region.Capacity() == 0) {
+        delete[] _charBuffer;
+    }
+    _charBuffer = nullptr;
+    _charBufferSize = 0;
+
+#ifdef DEBUG
+    if (_errorID == JsonError::JSON_NO_ERROR ) {
+        TJASSERT(_objectPool.CurrentAllocs() == _objectPool.Untracked());
+        TJASSERT(_arrayPool.CurrentAllocs() == _arrayPool.Untracked());
+        TJASSERT(_elementPool.CurrentAllocs() == _elementPool.Untracked());
+        TJASSERT(_numberPool.CurrentAllocs() == _numberPool.Untracked());
+        TJASSERT(_stringPool.CurrentAllocs() == _stringPool.Untracked());
+        TJASSERT(_reservedPool.CurrentAllocs() == _reservedPool.Untracked());
+    }
+#endif
+}
+
+void JsonDocument::InitDocument()
+{
+    _errorID = JsonError::JSON_NO_ERROR;
+    _errorStr1 = nullptr;
+    _errorStr2 = nullptr;
+    _hasLazyContent = false;
+    _strTable.Clear();
+    _blobArena.Reset();
+
+    // Every node is gone by now, so the whole region is free again.
+    if (_region.Capacity() != 0) {
+        _objectPool.ResetRegion();
+        _arrayPool.ResetRegion();
+        _elementPool.ResetRegion();
+        _numberPool.ResetRegion();
+        _stringPool.ResetRegion();
+        _reservedPool.ResetRegion();
+        _region.Reset();
+        _charBuffer = nullptr;
+        _charBufferSize = 0;
+    }
+}
+
+void JsonDocument::SetRegion(void *mem, size_t size)
+{
+    _region = MemRegion(mem, size);
+    _objectPool.SetRegion(&_region);
+    _arrayPool.SetRegion(&_region);
+    _elementPool.SetRegion(&_region);
+    _numberPool.SetRegion(&_region);
+    _stringPool.SetRegion(&_region);
+    _reservedPool.SetRegion(&_region);
+    _blobArena.SetRegion(&_region);
+    _parseOptions &= ~HEAP_OPTIONS;
+}
+
+template <class T, class Pool>
+T *JsonDocument::NewNode(Pool *pool)
+{
+    void *mem = pool->Alloc();
+    if (mem == nullptr) {
+        SetError(JsonError::JSON_ERROR_MEM_POOL_ERROR, 0, 0);
+        return nullptr;
+    }
+    T *node = new (mem) T(this);
+    node->_memPool = pool;
+    return node;
+}
+
+// The buffer is kept between parses so a reused document only allocates when it sees a
+// bigger input than before. Null, with JSON_ERROR_MEM_POOL_ERROR set, if the region is full.
+char *JsonDocument::ReserveBuffer(size_t len)
+{
+    if (_region.Capacity() != 0) {
+        _charBuffer = static_cast<char *>(_region.Alloc(len + 1 + BUFFER_PADDING, 1));
+        if (_charBuffer == nullptr) {
+            SetError(JsonError::JSON_ERROR_MEM_POOL_ERROR, 0, 0);
+            return nullptr;
+        }
+        _charBufferSize = len + 1 + BUFFER_PADDING;
+    } else if (_charBuffer == nullptr || _charBufferSize < len + 1 + BUFFER_PADDING) {
+        delete[] _charBuffer;
+        _charBuffer = new char[len + 1 + BUFFER_PADDING];
+        _charBufferSize = len + 1 + BUFFER_PADDING;
+    }
+    memset(_charBuffer + len + 1, 0, BUFFER_PADDING);
+    return _charBuffer;
+}
+
+// Parses exactly one value; anything but whitespace after it is an error.
+char *JsonDocument::ParseRoot(char *json, JsonNode **root)
+{
+    JsonNode *node = nullptr;
+    *root = nullptr;
+    json = Identify(json, &node);
+    if (json == nullptr || !*json) {
+        SetError(JsonError::JSON_ERROR_EMPTY_DOCUMENT, 0, 0);
+        return nullptr;
+    }
+    if (node == nullptr) {
+        SetError(JsonError::JSON_ERROR_PARSING, 0, 0);
+        return nullptr;
+    }
+
+    json = SkipSpace(node->ParseDeep(json));
+    if (json == nullptr || *json) {
+#ifdef DEBUG
+        node->GetMemPool()->SetTracked();
+#endif
+        DeleteNode(node);
+        SetError(JsonError::JSON_ERROR_PARSING, 0, 0);
+        return nullptr;
+    }
+    *root = InsertEndChild(node);
+    return json;
+}
+
+bool JsonDocument::DepthTracker::Exceeded() const
+{
+    if (_document->_parseDepth <= TINYJSON_MAX_DEPTH) {
+        return false;
+    }
+    _document->SetError(JsonError::JSON_ERROR_DEPTH_EXCEEDED, 0, 0);
+    return true;
+}
+
+void JsonDocument::SetError(JsonError error, const char *str1, const char *str2)
+{
+    if (_errorID == JsonError::JSON_NO_ERROR) {
+        _errorID = error;
+        _errorStr1 = str1;
+        _errorStr2 = str2;
+    }
+}
+
+char *JsonDocument::Identify(char *json, JsonNode **node)
+{
+    JsonNode *returnNode = nullptr;
+    char *start = json;
+    json = SkipSpace(json);
+    if (json == nullptr || !*json) {
+        return json;
+    }
+
+    switch (*json)
+    {
+    case 'n':
+    case 't':
+    case 'f':
+        returnNode = NewNode< JsonReserved >(&_reservedPool);
+        break;
+    case '\"':
+        returnNode = NewNode< JsonString >(&_stringPool);
+        ++json;
+        break;
+    case '{':
+        returnNode = NewNode< JsonObject >(&_objectPool);
+        ++json;
+        break;
+    case '[':
+        returnNode = NewNode< JsonArray >(&_arrayPool);
+        ++json;
+        break;
+    case '-':
+    case '0':
+    case '1':
+    case '2':
+    case '3':
+    case '4':
+    case '5':
+    case '6':
+    case '7':
+    case '8':
+    case '9':
+        returnNode = NewNode< JsonNumber >(&_numberPool);
+        break;
+    default:
+        *node = nullptr;
+        return json;
+    }
+
+    *node = returnNode;
+    return returnNode != nullptr ? json : nullptr;
+}
+
+template <bool MINIFIED>
+static inline char *SkipTrusted(char *json)
 {
+    return MINIFIED ? json : SkipSpace(json);
 }
 
-JsonNode::~JsonNode()
+// Parses the value at json into a new last child of parent. Nodes are attached before their
+// contents are parsed, so after an error the caller only has to delete the whole tree.
+// Bytes skipped without looking at them (the rest of true, false and null) may run into
+// BUFFER_PADDING, which is zero and stops everything else.
+template <bool MINIFIED>
+char *JsonDocument::ParseTrusted(char *json, JsonNode *parent)
 {
-    DeleteChildren();
-    if (_parent != nullptr) {
-        _parent->Unlink(this);
+    switch (*json) {
+    case '\"': {
+        JsonString *str = NewNode< JsonString >(&_stringPool);
+        if (str == nullptr) {
+            return nullptr;
+        }
+        parent->InsertEndChild(str);
+        return str->JsonString::ParseDeep(json + 1);
+    }
+    case '{': {
+        JsonObject *object = NewNode< JsonObject >(&_objectPool);
+        if (object == nullptr) {
+            return nullptr;
+        }
+        parent->InsertEndChild(object);
+        if (_parseOptions & ParseOptions::LAZY) {
+            return object->JsonObject::ParseDeep(json + 1);
+        }
+        DepthTracker depth(this);
+        if (depth.Exceeded()) {
+            return nullptr;
+        }
+        json = SkipTrusted< MINIFIED >(json + 1);
+        if (*json == '}') {
+            return json + 1;
+        }
+        while (*json == '\"') {
+            JsonElement *element = NewNode< JsonElement >(&_elementPool);
+            if (element == nullptr) {
+                return nullptr;
+            }
+            object->InsertEndChild(element);
+            json = ParseTrusted< MINIFIED >(json, element);
+            if (json == nullptr) {
+                return nullptr;
+            }
+            json = SkipTrusted< MINIFIED >(json);
+            if (*json != ':') {
+                break;
+            }
+            json = ParseTrusted< MINIFIED >(SkipTrusted< MINIFIED >(json + 1), element);
+            if (json == nullptr) {
+                return nullptr;
+            }
+            json = SkipTrusted< MINIFIED >(json);
+            if (*json == '}') {
+                return json + 1;
+            }
+            if (*json != ',') {
+                break;
+            }
+            json = SkipTrusted< MINIFIED >(json + 1);
+        }
+        SetError(JsonError::JSON_ERROR_OBJECT_MISMATCH, 0, 0);
+        return nullptr;
+    }
+    case '[': {
+        JsonArray *array = NewNode< JsonArray >(&_arrayPool);
+        if (array == nullptr) {
+            return nullptr;
+        }
+        parent->InsertEndChild(array);
+        if (_parseOptions & ParseOptions::LAZY) {
+            return array->JsonArray::ParseDeep(json + 1);
+        }
+        DepthTracker depth(this);
+        if (depth.Exceeded()) {
+            return nullptr;
+        }
+        json = SkipTrusted< MINIFIED >(json + 1);
+        if (*json == ']') {
+            return json + 1;
+        }
+        if (_parseOptions & (ParseOptions::PACK_NUMBERS | ParseOptions::PACK_SCALARS)) {
+            char *end = array->ParsePacked(json);
+            if (end != nullptr) {
+                return end;
+            }
+        }
+        for (;;) {
+            json = ParseTrusted< MINIFIED >(json, array);
+            if (json == nullptr) {
+                return nullptr;
+            }
+            json = SkipTrusted< MINIFIED >(json);
+            if (*json == ']') {
+                return json + 1;
+            }
+            if (*json != ',') {
+                break;
+            }
+            json = SkipTrusted< MINIFIED >(json + 1);
+        }
+        SetError(JsonError::JSON_ERROR_ARRAY_MISMATCH, 0, 0);
+        return nullptr;
+    }
+    case 't':
+    case 'f':
+    case 'n': {
+        JsonReserved *reserved = NewNode< JsonReserved >(&_reservedPool);
+        if (reserved == nullptr) {
+            return nullptr;
+        }
+        parent->InsertEndChild(reserved);
+        if (*json == 'f') {
+            reserved->_type = JsonReserved::Type::RESERVED_FALSE;
+            return json + 5;
+        }
+        reserved->_type = *json == 't' ? JsonReserved::Type::RESERVED_TRUE : JsonReserved::Type::RESERVED_NULL;
+        return json + 4;
+    }
+    default: {
+        bool isInt;
+        int64_t intValue;
+        double doubleValue;
+        const char *end = JsonUtil::ParseNumber(json, &isInt, &intValue, &doubleValue);
+        if (end == nullptr) {
+            SetError(JsonError::JSON_ERROR_PARSING, 0, 0);
+            return nullptr;
+        }
+        JsonNumber *number = NewNode< JsonNumber >(&_numberPool);
+        if (number == nullptr) {
+            return nullptr;
+        }
+        parent->InsertEndChild(number);
+        if (isInt) {
+            number->SetInt(intValue);
+        } else {
+            number->SetDouble(doubleValue);
+        }
+        return const_cast<char *>(end);
+    }
     }
 }
 
-void JsonNode::DeleteChildren()
+// Parses the len bytes in _charBuffer, which are not all whitespace, with the parser the options
+// ask for.
+void JsonDocument::ParseBuffer(size_t len)
 {
-    while (_firstChild != nullptr) {
-        JsonNode *node = _firstChild;
-        Unlink(node);
-
-        DeleteNode(node);
+    // Only the probes read it.
+    (void)len;
+    TJ_PROBE2(parse__start, this, len);
+    if (!(_parseOptions & ParseOptions::TRUSTED)) {
+        ParseDeep(_charBuffer);
+        TJ_PROBE3(parse__done, this, NodeCount(), (int)_errorID);
+        return;
     }
-    _firstChild = _lastChild = nullptr;
+    const bool minified = (_parseOptions & ParseOptions::TRUSTED_MINIFIED) == ParseOptions::TRUSTED_MINIFIED;
+    char *json = SkipSpace(_charBuffer);
+    while (*json) {
+        json = minified ? ParseTrusted< true >(json, this) : ParseTrusted< false >(json, this);
+        if (json == nullptr) {
+            // Leave no partial tree behind.
+            SetError(JsonError::JSON_ERROR_PARSING, 0, 0);
+            DeleteChildren();
+            break;
+        }
+        json = SkipSpace(json);
+    }
+    TJ_PROBE3(parse__done, this, NodeCount(), (int)_errorID);
 }
 
+// Nodes allocated from the pools, i.e. in the tree once a parse is done.
+int JsonDocument::NodeCount() const
+{
+    return _objectPool.CurrentAllocs() + _arrayPool.CurrentAllocs() + _elementPool.CurrentAllocs()
+        + _numberPool.CurrentAllocs() + _stringPool.CurrentAllocs() + _reservedPool.CurrentAllocs();
+}
 
-void JsonNode::Unlink(JsonNode *child)
+JsonElement *JsonDocument::CreatElement()
 {
-    TJASSERT(child->_parent == this);
-    if (child == _firstChild) {
-        _firstChild = _firstChild->_next;
+    return NewNode< JsonElement >(&_elementPool);
+}
+
+struct JsonDocument::CompactPools {
+    MemPoolT< sizeof(JsonObject) > objectPool;
+    MemPoolT< sizeof(JsonArray) > arrayPool;
+    MemPoolT< sizeof(JsonElement) > elementPool;
+    MemPoolT< sizeof(JsonNumber) > numberPool;
+    MemPoolT< sizeof(JsonString) > stringPool;
+    MemPoolT< sizeof(JsonReserved) > reservedPool;
+    MemArena blobArena;
+    StrTable strTable;
+
+    CompactPools() : strTable(&blobArena) {}
+};
+
+// Copies node, unlinked and without its children, into the fresh pools. The copy's _memPool
+// already points at the document's pool that will own the fresh blocks once Compact swaps them
+// in.
+JsonNode *JsonDocument::Relocate(const JsonNode *node, CompactPools *fresh)
+{
+    JsonNode *copy = nullptr;
+    MemPool *freshPool = nullptr;
+    if (node->ToObject() != nullptr) {
+        copy = new (fresh->objectPool.Alloc()) JsonObject(*node->ToObject());
+        copy->_memPool = &_objectPool;
+        freshPool = &fresh->objectPool;
+    } else if (node->ToArray() != nullptr) {
+        JsonArray *array = new (fresh->arrayPool.Alloc()) JsonArray(*node->ToArray());
+        if (array->_packedData != nullptr) {
+            size_t size = array->_packing == JsonArray::Packing::PACKED_VALUE ? sizeof(JsonValue) : sizeof(double);
+            void *data = fresh->blobArena.Alloc(size * array->_packedSize, size);
+            memcpy(data, array->_packedData, size * array->_packedSize);
+            array->_packedData = data;
+        }
+        copy = array;
+        copy->_memPool = &_arrayPool;
+        freshPool = &fresh->arrayPool;
+    } else if (node->ToElement() != nullptr) {
+        copy = new (fresh->elementPool.Alloc()) JsonElement(*node->ToElement());
+        copy->_memPool = &_elementPool;
+        freshPool = &fresh->elementPool;
+    } else if (node->ToString() != nullptr) {
+        JsonString *str = new (fresh->stringPool.Alloc()) JsonString(*node->ToString());
+        const char *start = str->_str.Start();
+        if (start != nullptr && (start < _charBuffer || start >= _charBuffer + _charBufferSize)) {
+            // Once strings were deduplicated, copies are too, to keep them shared.
+            char *chars = _strTable.Size() != 0
+                ? const_cast<char *>(fresh->strTable.Intern(start, str->_str.Length()))
+                : fresh->blobArena.StrDup(start, str->_str.Length());
+            str->_str.Set(chars, chars + str->_str.Length());
+        }
+        copy = str;
+        copy->_memPool = &_stringPool;
+        freshPool = &fresh->stringPool;
+    } else if (node->ToNumber() != nullptr) {
+        copy = new (fresh->numberPool.Alloc()) JsonNumber(*node->ToNumber());
+        copy->_memPool = &_numberPool;
+        freshPool = &fresh->numberPool;
+    } else {
+        copy = new (fresh->reservedPool.Alloc()) JsonReserved(*node->ToReserved());
+        copy->_memPool = &_reservedPool;
+        freshPool = &fresh->reservedPool;
     }
-    if (child == _lastChild) {
-        _lastChild = _lastChild->_prev;
+#ifdef DEBUG
+    freshPool->SetTracked();
+#endif
+    (void)freshPool;
+
+    copy->_parent = copy->_prev = copy->_next = nullptr;
+    copy->_firstChild = copy->_lastChild = nullptr;
+    return copy;
+}
+
+void JsonDocument::Compact()
+{
+    if (_region.Capacity() != 0) {
+        return;
     }
+    CompactPools fresh;
+    JsonNode *first = nullptr;
+    JsonNode *last = nullptr;
+
+    // Depth first without recursion, like NextInDocument, since trees built with InsertEndChild
+    // can be arbitrarily deep. An old node is garbage once copied, so its _prev is reused to find
+    // its copy; the walk only follows _firstChild, _next and _parent. The copies are linked by
+    // hand rather than with InsertEndChild, which would materialize a lazy copy and update the
+    // tracking counters of the old pools.
+    JsonNode *node = _firstChild;
+    while (node != nullptr) {
+        JsonNode *copy = Relocate(node, &fresh);
+        JsonNode *parent = node->_parent != this ? node->_parent->_prev : this;
+        JsonNode *&lastChild = parent != this ? parent->_lastChild : last;
+        copy->_parent = parent;
+        copy->_prev = lastChild;
+        if (lastChild != nullptr) {
+            lastChild->_next = copy;
+        } else if (parent != this) {
+            parent->_firstChild = copy;
+        } else {
+            first = copy;
+        }
+        lastChild = copy;
+        node->_prev = copy;
 
-    if (child->_prev != nullptr) {
-        child->_prev->_next = child->_next;
+        if (node->_firstChild != nullptr) {
+            node = node->_firstChild;
+            continue;
+        }
+        // The subtree of node is copied, and so are those of the ancestors it ends.
+        for (;;) {
+            if (node->ToObject() != nullptr && node->ToObject()->_members != nullptr) {
+                node->_prev->ToObject()->Index(&fresh.blobArena);
+            }
+            if (node->_next != nullptr) {
+                node = node->_next;
+                break;
+            }
+            node = node->_parent;
+            if (node == this) {
+                node = nullptr;
+                break;
+            }
+        }
     }
-    if (child->_next != nullptr) {
-        child->_next->_prev = child->_prev;
+
+    for (int i = 0; i < _batch.Size(); ++i) {
+        if (_batch[i].root != nullptr) {
+            _batch[i].root = _batch[i].root->_prev;
+        }
     }
-    child->_parent = nullptr;
+    _firstChild = first;
+    _lastChild = last;
+
+    // The old blocks go away with fresh, without running the old nodes' destructors.
+    _objectPool.Swap(fresh.objectPool);
+    _arrayPool.Swap(fresh.arrayPool);
+    _elementPool.Swap(fresh.elementPool);
+    _numberPool.Swap(fresh.numberPool);
+    _stringPool.Swap(fresh.stringPool);
+    _reservedPool.Swap(fresh.reservedPool);
+    _strTable.Swap(fresh.strTable);
+    _blobArena.Swap(fresh.blobArena);
 }
 
-JsonNode *JsonNode::InsertEndChild(JsonNode *node)
+// Depth-first order without recursion: down, else right, else up until there is a right.
+static JsonNode *NextInDocument(JsonNode *node, const JsonNode *document)
 {
-    if (_lastChild) {
-        TJASSERT(_firstChild);
-        TJASSERT(_lastChild->_next == 0);
-        _lastChild->_next = node;
-        node->_prev = _lastChild;
-        _lastChild = node;
+    if (node->FirstChild() != nullptr) {
+        return node->FirstChild();
+    }
+    while (node != document && node->NextSibling() == nullptr) {
+        node = node->Parent();
+    }
+    return node != document ? node->NextSibling() : nullptr;
+}
 
-        node->_next = 0;
+const char *JsonDocument::InternString(const char *str, size_t len)
+{
+    return _strTable.Intern(str, len);
+}
+
+void JsonDocument::DetachFromInput(bool deduplicate)
+{
+    MaterializeAll();
+    if (_charBuffer == nullptr || _region.Capacity() != 0) {
+        return;
     }
-    else {
-        TJASSERT(_firstChild == 0);
-        _firstChild = _lastChild = node;
 
-        node->_prev = 0;
-        node->_next = 0;
+    const char *bufferEnd = _charBuffer + _charBufferSize;
+    for (JsonNode *node = _firstChild; node; node = NextInDocument(node, this)) {
+        JsonString *str = node->ToString();
+        if (str != nullptr && str->_str.Start() >= _charBuffer && str->_str.Start() < bufferEnd) {
+            size_t len = str->_str.Length();
+            const char *copy = deduplicate ? InternString(str->_str.Start(), len)
+                : _blobArena.StrDup(str->_str.Start(), len);
+            str->_str.Set(const_cast<char *>(copy), const_cast<char *>(copy) + len);
+        }
     }
-    node->_parent = this;
+
+    delete[] _charBuffer;
+    _charBuffer = nullptr;
+    _charBufferSize = 0;
+}
+
+void JsonDocument::DedupStrings(size_t maxLength)
+{
+    MaterializeAll();
+    if (_region.Capacity() != 0) {
+        return;
+    }
+    for (JsonNode *node = _firstChild; node; node = NextInDocument(node, this)) {
+        JsonString *str = node->ToString();
+        if (str != nullptr && str->_str.Start() != nullptr && str->_str.Length() <= maxLength) {
+            size_t len = str->_str.Length();
+            char *shared = const_cast<char *>(InternString(str->_str.Start(), len));
+            str->_str.Set(shared, shared + len);
+        }
+    }
+}
+
+void JsonDocument::Freeze()
+{
+    MaterializeAll();
+    for (JsonNode *node = _firstChild; node; node = NextInDocument(node, this)) {
+        if (JsonObject *object = node->ToObject()) {
+            object->Freeze(&_blobArena);
+        }
+    }
+}
+
+JsonArena *JsonDocument::CreateArena()
+{
+    JsonArena *arena = new JsonArena(this);
+    std::lock_guard<std::mutex> lock(_arenaMutex);
+    _arenas.Push(arena);
+    return arena;
+}
+
+void JsonDocument::ReleaseArena(JsonArena *arena)
+{
 #ifdef DEBUG
-    node->_memPool->SetTracked();
-#endif // DEBUG
+    for (JsonNode *node = _firstChild; node; node = NextInDocument(node, this)) {
+        TJASSERT(!arena->Owns(node));
+    }
+#endif
+    std::lock_guard<std::mutex> lock(_arenaMutex);
+    for (int i = 0; i < _arenas.Size(); ++i) {
+        if (_arenas[i] == arena) {
+            _arenas[i] = _arenas[_arenas.Size() - 1];
+            _arenas.Pop();
+            delete arena;
+            return;
+        }
+    }
+    TJASSERT(false);
+}
 
-    return node;
+void JsonDocument::ReleaseArenas()
+{
+    std::lock_guard<std::mutex> lock(_arenaMutex);
+    for (int i = 0; i < _arenas.Size(); ++i) {
+        delete _arenas[i];
+    }
+    _arenas.Clear();
+}
+
+JsonError JsonDocument::Parse(const char *json, size_t len)
+{
+    DeleteChildren();
+    InitDocument();
+
+    if (json == nullptr || !*json) {
+        SetError(JsonError::JSON_ERROR_EMPTY_DOCUMENT, 0, 0);
+        return _errorID;
+    }
+    if (len == (size_t)(-1)) {
+        len = strlen(json);
+    }
+    if (ReserveBuffer(len) == nullptr) {
+        return _errorID;
+    }
+    memcpy(_charBuffer, json, len);
+    _charBuffer[len] = 0;
+
+    json = JsonUtil::SkipWhiteSpace(json);
+    if (json == nullptr || !*json) {
+        SetError(JsonError::JSON_ERROR_EMPTY_DOCUMENT, 0, 0);
+        return _errorID;
+    }
+
+    ParseBuffer(len);
+    return _errorID;
+}
+
+JsonError JsonDocument::ParseBatch(const char *const *jsons, const size_t *lens, int count)
+{
+    DeleteChildren();
+    InitDocument();
+
+    // Copy every message into one buffer up front: a single allocation (usually none on a
+    // reused document) and the parser then walks memory strictly front to back.
+    BatchEntry *entries = _batch.PushArr(count);
+    size_t total = 0;
+    for (int i = 0; i < count; ++i) {
+        entries[i].root = nullptr;
+        entries[i].error = JsonError::JSON_NO_ERROR;
+        entries[i].length = lens != nullptr ? lens[i] : strlen(jsons[i]);
+        total += entries[i].length + 1;
+    }
+    char *buffer = ReserveBuffer(total);
+    if (buffer == nullptr) {
+        _batch.Clear();
+        return _errorID;
+    }
+    for (int i = 0; i < count; ++i) {
+        memcpy(buffer, jsons[i], entries[i].length);
+        buffer[entries[i].length] = 0;
+        buffer += entries[i].length + 1;
+    }
+
+    JsonError firstError = JsonError::JSON_NO_ERROR;
+    buffer = _charBuffer;
+    for (int i = 0; i < count; ++i) {
+        char *next = buffer + entries[i].length + 1;
+
+        _errorID = JsonError::JSON_NO_ERROR;
+        TJ_PROBE2(parse__start, this, (size_t)(next - buffer - 1));
+#if defined(TINYJSON_USDT)
+        const int nodesBefore = NodeCount();
+#endif
+        ParseRoot(buffer, &entries[i].root);
+        TJ_PROBE3(parse__done, this, NodeCount() - nodesBefore, (int)_errorID);
+        entries[i].error = _errorID;
+        if (firstError == JsonError::JSON_NO_ERROR) {
+            firstError = _errorID;
+        }
+        buffer = next;
+    }
+    _errorID = firstError;
+    return _errorID;
+}
+
+JsonError JsonDocument::LoadFile(const char *filename)
+{
+    DeleteChildren();
+    InitDocument();
+
+    FILE *fp = fopen(filename, "rb");
+    if (fp == nullptr) {
+        // Not found only when it isn't there; permissions, a directory and the like differ.
+        SetError(errno == ENOENT ? JsonError::JSON_ERROR_FILE_NOT_FOUND
+            : JsonError::JSON_ERROR_FILE_COULD_NOT_BE_OPENED, filename, 0);
+        return _errorID;
+    }
+    LoadFile(fp);
+    fclose(fp);
+    return _errorID;
+}
+
+// Reads straight into _charBuffer, so a file costs one copy instead of two.
+JsonError JsonDocument::LoadFile(FILE *fp)
+{
+    DeleteChildren();
+    InitDocument();
+
+    if (fseek(fp, 0, SEEK_END) != 0) {
+        SetError(JsonError::JSON_ERROR_FILE_READ_ERROR, 0, 0);
+        return _errorID;
+    }
+    long filelength = ftell(fp);
+    if (filelength < 0 || fseek(fp, 0, SEEK_SET) != 0) {
+        SetError(JsonError::JSON_ERROR_FILE_READ_ERROR, 0, 0);
+        return _errorID;
+    }
+    if (filelength == 0) {
+        SetError(JsonError::JSON_ERROR_EMPTY_DOCUMENT, 0, 0);
+        return _errorID;
+    }
+    // A directory opens on some systems but can't be read, and its length is made up.
+    if (getc(fp) == EOF || fseek(fp, 0, SEEK_SET) != 0) {
+        SetError(JsonError::JSON_ERROR_FILE_READ_ERROR, 0, 0);
+        return _errorID;
+    }
+
+    size_t len = (size_t)filelength;
+    if (ReserveBuffer(len) == nullptr) {
+        return _errorID;
+    }
+    if (fread(_charBuffer, 1, len, fp) != len) {
+        SetError(JsonError::JSON_ERROR_FILE_READ_ERROR, 0, 0);
+        return _errorID;
+    }
+    _charBuffer[len] = 0;
+
+    if (!*JsonUtil::SkipWhiteSpace(_charBuffer)) {
+        SetError(JsonError::JSON_ERROR_EMPTY_DOCUMENT, 0, 0);
+        return _errorID;
+    }
+
+    ParseBuffer(len);
+    return _errorID;
+}
+
+void JsonDocument::ParseFiles(const char *const *paths, int count, JsonThreadPool *pool,
+    const JsonFileCallback &callback, unsigned parseOptions)
+{
+    std::unique_ptr<JsonDocument[]> docs(new JsonDocument[pool->ThreadCount()]);
+    for (int i = 0; i < pool->ThreadCount(); ++i) {
+        docs[i].SetParseOptions(parseOptions);
+    }
+    pool->ParallelFor(count, [&](int worker, int index) {
+        JsonDocument *doc = &docs[worker];
+        JsonError error = doc->LoadFile(paths[index]);
+        callback(index, doc, error);
+    });
+}
+
+bool JsonDocument::Accept(JsonVisitor *visitor) const
+{
+    if (visitor->VisitEnter(*this)) {
+        for (const JsonNode *node = FirstChild(); node; node = node->NextSibling()) {
+            if (!node->Accept(visitor)) {
+                break;
+            }
+        }
+    }
+    return visitor->VisitExit(*this);
 }
 
-char *JsonNode::ParseDeep(char *json)
+/********************************************************************************************/
+
+#ifdef DEBUG
+// Marks an allocation in progress on an arena, for the check that no producer is still using
+// an arena when it is freed.
+class ArenaUse
 {
-    while (json != nullptr && *json) {
-        JsonNode *node = nullptr;
+public:
+    explicit ArenaUse(std::atomic<int> *busy) : _busy(busy)
+    {
+        ++*_busy;
+    }
+    ~ArenaUse()
+    {
+        --*_busy;
+    }
+private:
+    std::atomic<int> *_busy;
+};
+#define TJ_ARENA_USE()          ArenaUse use(&_busy)
+#else
+#define TJ_ARENA_USE()
+#endif
 
-        json = _document->Identify(json, &node);
-        if (json == nullptr || node == nullptr) {
-            break;
-        }
+JsonArena::JsonArena(JsonDocument *doc) :
+    _document(doc)
+#ifdef DEBUG
+    , _busy(0)
+#endif
+{
+}
 
-        json = JsonUtil::SkipWhiteSpace(node->ParseDeep(json));
-        if (json == nullptr) {
+JsonArena::~JsonArena()
+{
 #ifdef DEBUG
-            node->GetMemPool()->SetTracked();
+    TJASSERT(_busy == 0);
 #endif
-            DeleteNode(node);
-            node = nullptr;
-            _document->SetError(JsonError::JSON_ERROR_PARSING, 0, 0);
-            break;
-        }
+}
 
-        if (node != nullptr) {
-            this->InsertEndChild(node);
-        }
-    }
-    return json;
+bool JsonArena::Owns(const JsonNode *node) const
+{
+    const MemPool *pool = node->_memPool;
+    return pool == &_objectPool || pool == &_arrayPool || pool == &_elementPool
+        || pool == &_numberPool || pool == &_stringPool || pool == &_reservedPool;
 }
 
-/********************************************************************************************/
-JsonReserved::JsonReserved(JsonDocument *doc) : JsonNode(doc),
-    _type(JsonReserved::Type::RESERVED)
-{}
+JsonObject *JsonArena::NewObject()
+{
+    TJ_ARENA_USE();
+    JsonObject *node = new (_objectPool.Alloc()) JsonObject(_document);
+    node->_memPool = &_objectPool;
+    return node;
+}
 
-JsonReserved::~JsonReserved()
-{}
+JsonArray *JsonArena::NewArray()
+{
+    TJ_ARENA_USE();
+    JsonArray *node = new (_arrayPool.Alloc()) JsonArray(_document);
+    node->_memPool = &_arrayPool;
+    return node;
+}
 
-char *JsonReserved::ParseDeep(char *json)
+JsonElement *JsonArena::NewElement(const char *key)
 {
-    if (!strncmp(json, "null", 4)) {
-        _type = JsonReserved::Type::RESERVED_NULL;
-        json += 4;
-    } else if (!strncmp(json, "true", 4)) {
-        _type = JsonReserved::Type::RESERVED_TRUE;
-        json += 4;
-    } else if (!strncmp(json, "false", 5)) {
-        _type = JsonReserved::Type::RESERVED_FALSE;
-        json += 5;
-    } else {
-        _document->SetError(JsonError::JSON_ERROR_PARSING_RESERVED, 0, 0);
-        json = nullptr;
-    }
+    return NewElement(key, strlen(key));
+}
 
-    return json;
+JsonElement *JsonArena::NewElement(const char *key, size_t len)
+{
+    TJ_ARENA_USE();
+    JsonElement *node = new (_elementPool.Alloc()) JsonElement(_document);
+    node->_memPool = &_elementPool;
+    node->InsertEndChild(NewString(key, len));
+    return node;
 }
 
-bool JsonReserved::Accept(JsonVisitor *visitor) const
+JsonString *JsonArena::NewString(const char *str)
 {
-    return visitor->Visit(*this);
+    return NewString(str, strlen(str));
 }
 
-JsonNumber::JsonNumber(JsonDocument *doc) : JsonNode(doc),
-    _valueFloat(0.0f),
-    _valueInt(0)
+JsonString *JsonArena::NewString(const char *str, size_t len)
 {
+    TJ_ARENA_USE();
+    JsonString *node = new (_stringPool.Alloc()) JsonString(_document);
+    node->_memPool = &_stringPool;
+    char *copy = _strArena.StrDup(str, len);
+    node->_str.Set(copy, copy + len);
+    return node;
 }
 
-JsonNumber::~JsonNumber()
+JsonNumber *JsonArena::NewNumber(double value)
 {
+    TJ_ARENA_USE();
+    JsonNumber *node = new (_numberPool.Alloc()) JsonNumber(_document);
+    node->_memPool = &_numberPool;
+    node->SetDouble(value);
+    return node;
 }
 
-char *JsonNumber::ParseDeep(char *json)
+JsonNumber *JsonArena::NewNumber(int64_t value)
 {
-    char *endptr;
-    float n;
-    json = JsonUtil::SkipWhiteSpace(json);
-    if (json == nullptr) {
-        return nullptr;
-    }
+    TJ_ARENA_USE();
+    JsonNumber *node = new (_numberPool.Alloc()) JsonNumber(_document);
+    node->_memPool = &_numberPool;
+    node->SetInt(value);
+    return node;
+}
 
-#if __STDC_VERSION__ >= 199901L
-    n = strtof(num, &endptr);
-#else
-    n = (float)strtod(json, &endptr);
-#endif
+JsonReserved *JsonArena::NewReserved(JsonReserved::Type type)
+{
+    TJ_ARENA_USE();
+    JsonReserved *node = new (_reservedPool.Alloc()) JsonReserved(_document);
+    node->_memPool = &_reservedPool;
+    node->_type = type;
+    return node;
+}
 
-    if (endptr != json) {
-        _valueFloat = n;
-        _valueInt = (int)n;
-        return endptr;
+/********************************************************************************************/
+
+// Header and children in one allocation: count node pointers for an array, count key/value
+// pairs for an object, count bytes plus a nul for a string.
+struct JsonPersistent::Node {
+    std::atomic<int> refs;
+    Kind kind;
+    int count;
+    JsonValue value;
+
+    Node **Children()
+    {
+        return reinterpret_cast<Node **>(this + 1);
+    }
+    char *Chars()
+    {
+        return reinterpret_cast<char *>(this + 1);
     }
-    _document->SetError(JsonError::JSON_ERROR_OBJECT_MISMATCH, 0, 0);
 
-    return nullptr;
-}
+    static Node *Create(Kind kind, int count)
+    {
+        size_t extra = 0;
+        if (kind == Kind::ARRAY) {
+            extra = sizeof(Node *) * count;
+        } else if (kind == Kind::OBJECT) {
+            extra = sizeof(Node *) * count * 2;
+        } else if (kind == Kind::STRING) {
+            extra = count + 1;
+        }
+        Node *node = new (::operator new(sizeof(Node) + extra)) Node();
+        node->refs = 1;
+        node->kind = kind;
+        node->count = count;
+        return node;
+    }
+    int ChildCount() const
+    {
+        return kind == Kind::ARRAY ? count : kind == Kind::OBJECT ? count * 2 : 0;
+    }
+    static Node *Retain(Node *node)
+    {
+        if (node != nullptr) {
+            node->refs.fetch_add(1, std::memory_order_relaxed);
+        }
+        return node;
+    }
+    static void Release(Node *node)
+    {
+        if (node == nullptr || node->refs.fetch_sub(1, std::memory_order_acq_rel) != 1) {
+            return;
+        }
+        for (int i = 0; i < node->ChildCount(); ++i) {
+            Release(node->Children()[i]);
+        }
+        node->~Node();
+        ::operator delete(node);
+    }
+    // Same kind and children as node, with extra slots; children are retained.
+    static Node *CopyOf(Node *node, int count)
+    {
+        Node *copy = Create(node->kind, count);
+        int n = node->ChildCount() < copy->ChildCount() ? node->ChildCount() : copy->ChildCount();
+        for (int i = 0; i < n; ++i) {
+            copy->Children()[i] = Retain(node->Children()[i]);
+        }
+        return copy;
+    }
+    int IndexOf(const char *key) const
+    {
+        size_t len = strlen(key);
+        Node **pairs = const_cast<Node *>(this)->Children();
+        for (int i = 0; i < count; ++i) {
+            if ((size_t)pairs[i * 2]->count == len && !memcmp(pairs[i * 2]->Chars(), key, len)) {
+                return i;
+            }
+        }
+        return -1;
+    }
+};
 
-bool JsonNumber::Accept(JsonVisitor *visitor) const
+JsonPersistent::JsonPersistent(const JsonPersistent &other) : _node(Node::Retain(other._node))
 {
-    return visitor->Visit(*this);
 }
 
-JsonString::JsonString(JsonDocument *doc) : JsonNode(doc)
+JsonPersistent &JsonPersistent::operator=(const JsonPersistent &other)
 {
+    Node *old = _node;
+    _node = Node::Retain(other._node);
+    Node::Release(old);
+    return *this;
 }
 
-JsonString::~JsonString()
+JsonPersistent::~JsonPersistent()
 {
+    Node::Release(_node);
 }
 
-char *JsonString::ParseDeep(char *json)
+JsonPersistent JsonPersistent::Scalar(JsonValue value)
 {
-    char *ptr = json;
-    int len = 0;
-    while (*ptr != '\"' && *ptr && ++len) {
-        if (*ptr++ == '\\') {
-            ptr++;
-        }
+    if (value.GetType() == JsonValue::Type::VALUE_NODE) {
+        return JsonPersistent();
     }
-    if (ptr == nullptr || !*ptr) {
-        _document->SetError(JsonError::JSON_ERROR_PARSING_STRING, 0, 0);
-        return nullptr;
-    }
-    *ptr = 0;
-    _str.Set(json, ptr);
-    json = ptr + 1;
-    return json;
+    Node *node = Node::Create(Kind::SCALAR, 0);
+    node->value = value;
+    return JsonPersistent(node);
 }
 
-bool JsonString::Accept(JsonVisitor *visitor) const
+JsonPersistent JsonPersistent::String(const char *str)
 {
-    return visitor->Visit(*this);
+    return String(str, strlen(str));
 }
 
-/********************************************************************************************/
+JsonPersistent JsonPersistent::String(const char *str, size_t len)
+{
+    Node *node = Node::Create(Kind::STRING, (int)len);
+    memcpy(node->Chars(), str, len);
+    node->Chars()[len] = 0;
+    return JsonPersistent(node);
+}
 
-JsonElement::JsonElement(JsonDocument *doc) : JsonNode(doc)
+JsonPersistent JsonPersistent::EmptyArray()
 {
+    return JsonPersistent(Node::Create(Kind::ARRAY, 0));
 }
 
-JsonElement::~JsonElement()
+JsonPersistent JsonPersistent::EmptyObject()
 {
+    return JsonPersistent(Node::Create(Kind::OBJECT, 0));
 }
 
-char *JsonElement::ParseDeep(char *json)
+JsonPersistent JsonPersistent::FromNode(const JsonNode *node)
 {
-    do{
-        if (*json != '\"') {
-            break;
+    if (node == nullptr) {
+        return JsonPersistent();
+    }
+    if (node->ToDocument() != nullptr) {
+        return FromNode(node->FirstChild());
+    }
+    if (node->ToString() != nullptr) {
+        return String(node->ToString()->CStr(), node->ToString()->Length());
+    }
+    if (node->ToObject() != nullptr) {
+        int count = 0;
+        for (const JsonNode *child = node->FirstChild(); child; child = child->NextSibling()) {
+            ++count;
         }
-        //key
-        json = JsonUtil::SkipWhiteSpace(JsonNode::ParseDeep(json));
-        if (json == nullptr || *json != ':') {
-            break;
+        Node *object = Node::Create(Kind::OBJECT, count);
+        int i = 0;
+        for (const JsonNode *child = node->FirstChild(); child; child = child->NextSibling(), ++i) {
+            const JsonElement *element = child->ToElement();
+            JsonPersistent key = String(element->Key()->CStr(), element->Key()->Length());
+            JsonPersistent value = FromNode(element->Value());
+            object->Children()[i * 2] = Node::Retain(key._node);
+            object->Children()[i * 2 + 1] = Node::Retain(value._node);
         }
-        ++json;
-        //value
-        json = JsonUtil::SkipWhiteSpace(JsonNode::ParseDeep(json));
-        if (json == nullptr) {
-            break;
+        return JsonPersistent(object);
+    }
+    if (node->ToArray() != nullptr) {
+        const JsonArray *array = node->ToArray();
+        int count = array->PackedSize();
+        for (const JsonNode *child = node->FirstChild(); child; child = child->NextSibling()) {
+            ++count;
         }
-        return json;
-    } while (false);
-
-    _document->SetError(JsonError::JSON_ERROR_PARSING_ELEMENT, 0, 0);
-    return nullptr;
+        Node *items = Node::Create(Kind::ARRAY, count);
+        int i = 0;
+        for (; i < array->PackedSize(); ++i) {
+            items->Children()[i] = Node::Retain(Scalar(array->PackedAt(i))._node);
+        }
+        for (const JsonNode *child = node->FirstChild(); child; child = child->NextSibling(), ++i) {
+            items->Children()[i] = Node::Retain(FromNode(child)._node);
+        }
+        return JsonPersistent(items);
+    }
+    return Scalar(JsonValue::FromNode(node));
 }
 
-bool JsonElement::Accept(JsonVisitor *visitor) const
+JsonPersistent::Kind JsonPersistent::GetKind() const
 {
-    if (visitor->VisitEnter(*this)) {
-        for (const JsonNode *node = FirstChild(); node; node = node->NextSibling()) {
-            if (!node->Accept(visitor)) {
-                break;
-            }
-        }
-    }
-    return visitor->VisitExit(*this);
+    return _node != nullptr ? _node->kind : Kind::SCALAR;
 }
 
-/********************************************************************************************/
-
-JsonObject::JsonObject(JsonDocument *doc) : JsonNode(doc)
+JsonValue JsonPersistent::Value() const
 {
+    return _node != nullptr && _node->kind == Kind::SCALAR ? _node->value : JsonValue::Null();
 }
 
+const char *JsonPersistent::CStr() const
+{
+    return _node != nullptr && _node->kind == Kind::STRING ? _node->Chars() : nullptr;
+}
 
-JsonObject::~JsonObject()
+int JsonPersistent::Size() const
 {
+    return _node != nullptr ? _node->count : 0;
 }
 
-char *JsonObject::ParseDeep(char *json)
+JsonPersistent JsonPersistent::At(int index) const
 {
-    json = JsonUtil::SkipWhiteSpace(json);
-    if (json == nullptr || !*json) {
-        _document->SetError(JsonError::JSON_ERROR_OBJECT_MISMATCH, 0, 0);
-        return nullptr;
+    if (_node == nullptr || index < 0 || index >= _node->count) {
+        return JsonPersistent();
     }
-
-    if (*json == '}') {
-        ++json;
-        return json;
+    if (_node->kind == Kind::ARRAY) {
+        return JsonPersistent(Node::Retain(_node->Children()[index]));
     }
-
-    json = ParseElement(json);
-
-    while (*json == ',') {
-        ++json;
-        json = ParseElement(json);
-        if (json == nullptr) {
-            _document->SetError(JsonError::JSON_ERROR_OBJECT_MISMATCH, 0, 0);
-            return nullptr;
-        }
+    if (_node->kind == Kind::OBJECT) {
+        return JsonPersistent(Node::Retain(_node->Children()[index * 2 + 1]));
     }
+    return JsonPersistent();
+}
 
-    if (*json == '}') {
-        ++json;
-        return json;
+const char *JsonPersistent::KeyAt(int index) const
+{
+    if (_node == nullptr || _node->kind != Kind::OBJECT || index < 0 || index >= _node->count) {
+        return nullptr;
     }
-
-    _document->SetError(JsonError::JSON_ERROR_OBJECT_MISMATCH, 0, 0);
-    return nullptr;
+    return _node->Children()[index * 2]->Chars();
 }
 
-char *JsonObject::ParseElement(char *json) {
-    JsonElement *node = _document->CreatElement();
-    json = JsonUtil::SkipWhiteSpace(node->ParseDeep(json));
-    if (json == nullptr) {
-#ifdef DEBUG
-        node->GetMemPool()->SetTracked();
-#endif
-        DeleteNode(node);
-        node = nullptr;
-        _document->SetError(JsonError::JSON_ERROR_PARSING_ELEMENT, 0, 0);
-        return nullptr;
+JsonPersistent JsonPersistent::Find(const char *key) const
+{
+    if (_node == nullptr || _node->kind != Kind::OBJECT) {
+        return JsonPersistent();
     }
-    InsertEndChild(node);
-    return json;
+    return At(_node->IndexOf(key));
 }
 
-bool JsonObject::Accept(JsonVisitor *visitor) const
+JsonPersistent JsonPersistent::Set(const char *key, const JsonPersistent &value) const
 {
-    if (visitor->VisitEnter(*this)) {
-        for (const JsonNode *node = FirstChild(); node; node = node->NextSibling()) {
-            if (!node->Accept(visitor)) {
-                break;
-            }
-        }
-    }
-    return visitor->VisitExit(*this);
+    if (_node == nullptr || _node->kind != Kind::OBJECT || value._node == nullptr) {
+        return JsonPersistent();
+    }
+    int index = _node->IndexOf(key);
+    if (index >= 0) {
+        Node *copy = Node::CopyOf(_node, _node->count);
+        Node::Release(copy->Children()[index * 2 + 1]);
+        copy->Children()[index * 2 + 1] = Node::Retain(value._node);
+        return JsonPersistent(copy);
+    }
+    Node *copy = Node::CopyOf(_node, _node->count + 1);
+    copy->Children()[_node->count * 2] = Node::Retain(String(key)._node);
+    copy->Children()[_node->count * 2 + 1] = Node::Retain(value._node);
+    return JsonPersistent(copy);
 }
-/********************************************************************************************/
 
-JsonArray::JsonArray(JsonDocument *doc) : JsonNode(doc)
+JsonPersistent JsonPersistent::Set(int index, const JsonPersistent &value) const
 {
+    if (_node == nullptr || _node->kind != Kind::ARRAY || index < 0 || index >= _node->count
+        || value._node == nullptr) {
+        return JsonPersistent();
+    }
+    Node *copy = Node::CopyOf(_node, _node->count);
+    Node::Release(copy->Children()[index]);
+    copy->Children()[index] = Node::Retain(value._node);
+    return JsonPersistent(copy);
 }
 
-JsonArray::~JsonArray()
+JsonPersistent JsonPersistent::Append(const JsonPersistent &value) const
 {
+    if (_node == nullptr || _node->kind != Kind::ARRAY || value._node == nullptr) {
+        return JsonPersistent();
+    }
+    Node *copy = Node::CopyOf(_node, _node->count + 1);
+    copy->Children()[_node->count] = Node::Retain(value._node);
+    return JsonPersistent(copy);
 }
 
-char *JsonArray::ParseDeep(char *json)
+JsonPersistent JsonPersistent::Remove(const char *key) const
 {
-    json = JsonUtil::SkipWhiteSpace(json);
-    if (json == nullptr || !*json) {
-        _document->SetError(JsonError::JSON_ERROR_ARRAY_MISMATCH, 0, 0);
-        return nullptr;
+    if (_node == nullptr || _node->kind != Kind::OBJECT) {
+        return JsonPersistent();
+    }
+    int index = _node->IndexOf(key);
+    if (index < 0) {
+        return *this;
+    }
+    Node *copy = Node::Create(Kind::OBJECT, _node->count - 1);
+    for (int i = 0, j = 0; i < _node->count; ++i) {
+        if (i != index) {
+            copy->Children()[j * 2] = Node::Retain(_node->Children()[i * 2]);
+            copy->Children()[j * 2 + 1] = Node::Retain(_node->Children()[i * 2 + 1]);
+            ++j;
+        }
     }
+    return JsonPersistent(copy);
+}
 
-    if (*json == ']') {
-        ++json;
-        return json;
+JsonPersistent JsonPersistent::SetIn(const char *const *path, int depth, const JsonPersistent &value) const
+{
+    if (depth == 0) {
+        return value;
     }
-    
-    json = JsonUtil::SkipWhiteSpace(JsonNode::ParseDeep(json));
-    if (json == nullptr) {
+    if (GetKind() == Kind::OBJECT) {
+        if (depth == 1) {
+            return Set(path[0], value);
+        }
+        JsonPersistent child = Find(path[0]).SetIn(path + 1, depth - 1, value);
+        return child.IsEmpty() ? child : Set(path[0], child);
+    }
+    if (GetKind() == Kind::ARRAY) {
+        char *end;
+        long index = strtol(path[0], &end, 10);
+        if (*path[0] == 0 || *end != 0) {
+            return JsonPersistent();
+        }
+        JsonPersistent child = At((int)index).SetIn(path + 1, depth - 1, value);
+        return child.IsEmpty() ? child : Set((int)index, child);
+    }
+    return JsonPersistent();
+}
+
+JsonNode *JsonPersistent::ToNode(JsonArena *arena) const
+{
+    if (_node == nullptr) {
         return nullptr;
     }
-    while (*json == ',') {
-        ++json;
-        json = JsonUtil::SkipWhiteSpace(JsonNode::ParseDeep(json));
-        if (json == nullptr || !*json) {
-            _document->SetError(JsonError::JSON_ERROR_ARRAY_MISMATCH, 0, 0);
-            return nullptr;
+    switch (_node->kind) {
+    case Kind::STRING:
+        return arena->NewString(_node->Chars(), (size_t)_node->count);
+    case Kind::ARRAY: {
+        JsonArray *array = arena->NewArray();
+        for (int i = 0; i < _node->count; ++i) {
+            array->InsertEndChild(At(i).ToNode(arena));
         }
+        return array;
     }
-    if (*json == ']') {
-        ++json;
-        return json;
+    case Kind::OBJECT: {
+        JsonObject *object = arena->NewObject();
+        for (int i = 0; i < _node->count; ++i) {
+            Node *key = _node->Children()[i * 2];
+            JsonElement *element = arena->NewElement(key->Chars(), (size_t)key->count);
+            element->InsertEndChild(At(i).ToNode(arena));
+            object->InsertEndChild(element);
+        }
+        return object;
+    }
+    default:
+        break;
+    }
+    switch (_node->value.GetType()) {
+    case JsonValue::Type::VALUE_BOOL:
+        return arena->NewReserved(_node->value.AsBool() ? JsonReserved::Type::RESERVED_TRUE
+            : JsonReserved::Type::RESERVED_FALSE);
+    case JsonValue::Type::VALUE_NULL:
+        return arena->NewReserved(JsonReserved::Type::RESERVED_NULL);
+    case JsonValue::Type::VALUE_INT:
+        return arena->NewNumber((int64_t)_node->value.AsInt());
+    default:
+        return arena->NewNumber(_node->value.AsDouble());
     }
-
-    _document->SetError(JsonError::JSON_ERROR_ARRAY_MISMATCH, 0, 0);
-    return nullptr;
 }
 
-bool JsonArray::Accept(JsonVisitor *visitor) const
+/********************************************************************************************/
+
+JsonValue JsonTape::Value() const
 {
-    if (visitor->VisitEnter(*this)) {
-        for (const JsonNode *node = FirstChild(); node; node = node->NextSibling()) {
-            if (!node->Accept(visitor)) {
-                break;
-            }
-        }
-    }
-    return visitor->VisitExit(*this);
+    if (_entries == nullptr || _entries[_index].kind != (uint32_t)Kind::SCALAR) {
+        return JsonValue::Null();
+    }
+    return JsonValue::FromBits(_entries[_index].data);
 }
-/********************************************************************************************/
-JsonDocument::JsonDocument() :
-    JsonNode(nullptr),
-    _errorID(JsonError::JSON_NO_ERROR),
-    _errorStr1(nullptr),
-    _errorStr2(nullptr),
-    _charBuffer(nullptr)
+
+const char *JsonTape::CStr() const
 {
-    _document = this;
+    if (_entries == nullptr || _entries[_index].kind != (uint32_t)Kind::STRING) {
+        return nullptr;
+    }
+    return _strings + _entries[_index].data;
 }
 
-JsonDocument::~JsonDocument()
+int JsonTape::Size() const
 {
-    DeleteChildren();
-    delete[] _charBuffer;
-    _charBuffer = nullptr;
+    if (_entries == nullptr || _entries[_index].kind == (uint32_t)Kind::SCALAR) {
+        return 0;
+    }
+    return (int)_entries[_index].size;
+}
 
-#ifdef DEBUG
-    if (_errorID == JsonError::JSON_NO_ERROR ) {
-        TJASSERT(_objectPool.CurrentAllocs() == _objectPool.Untracked());
-        TJASSERT(_arrayPool.CurrentAllocs() == _arrayPool.Untracked());
-        TJASSERT(_elementPool.CurrentAllocs() == _elementPool.Untracked());
-        TJASSERT(_numberPool.CurrentAllocs() == _numberPool.Untracked());
-        TJASSERT(_stringPool.CurrentAllocs() == _stringPool.Untracked());
-        TJASSERT(_reservedPool.CurrentAllocs() == _reservedPool.Untracked());
+JsonTape JsonTape::At(int index) const
+{
+    if (_entries == nullptr || index < 0 || index >= Size()) {
+        return JsonTape();
     }
-#endif
+    const JsonTapeEntry &entry = _entries[_index];
+    if (entry.kind == (uint32_t)Kind::ARRAY) {
+        return JsonTape(_entries, _strings, entry.data + index);
+    }
+    if (entry.kind == (uint32_t)Kind::OBJECT) {
+        return JsonTape(_entries, _strings, entry.data + index * 2 + 1);
+    }
+    return JsonTape();
 }
 
-void JsonDocument::InitDocument()
+const char *JsonTape::KeyAt(int index) const
 {
-    _errorID = JsonError::JSON_NO_ERROR;
-    _errorStr1 = nullptr;
-    _errorStr2 = nullptr;
+    if (_entries == nullptr || _entries[_index].kind != (uint32_t)Kind::OBJECT
+            || index < 0 || index >= Size()) {
+        return nullptr;
+    }
+    return _strings + _entries[_entries[_index].data + index * 2].data;
+}
 
-    delete[] _charBuffer;
-    _charBuffer = nullptr;
+// Key order of tapes: memcmp over the common length, then the shorter key first.
+static int CompareTapeKey(const char *a, size_t aLen, const char *b, size_t bLen)
+{
+    int cmp = memcmp(a, b, aLen < bLen ? aLen : bLen);
+    if (cmp != 0) {
+        return cmp;
+    }
+    return aLen < bLen ? -1 : aLen > bLen ? 1 : 0;
 }
 
-void JsonDocument::SetError(JsonError error, const char *str1, const char *str2)
+JsonTape JsonTape::Find(const char *key) const
 {
-    if (_errorID == JsonError::JSON_NO_ERROR) {
-        _errorID = error;
-        _errorStr1 = str1;
-        _errorStr2 = str2;
+    if (_entries == nullptr || _entries[_index].kind != (uint32_t)Kind::OBJECT) {
+        return JsonTape();
+    }
+    size_t len = strlen(key);
+    const JsonTapeEntry *pairs = _entries + _entries[_index].data;
+    int low = 0;
+    int high = (int)_entries[_index].size;
+    while (low < high) {
+        int mid = (low + high) / 2;
+        const JsonTapeEntry &name = pairs[mid * 2];
+        if (CompareTapeKey(_strings + name.data, name.size, key, len) < 0) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    if (low < (int)_entries[_index].size) {
+        const JsonTapeEntry &name = pairs[low * 2];
+        if (CompareTapeKey(_strings + name.data, name.size, key, len) == 0) {
+            return At(low);
+        }
     }
+    return JsonTape();
 }
 
-char *JsonDocument::Identify(char *json, JsonNode **node)
+namespace
 {
-    JsonNode *returnNode = nullptr;
-    char *start = json;
-    json = JsonUtil::SkipWhiteSpace(json);
-    if (json == nullptr || !*json) {
-        return json;
+struct TapeBuilder {
+    std::vector<JsonTapeEntry> entries;
+    std::string strings;
+    std::map<std::string, uint64_t> offsets;
+
+    JsonTapeEntry String(const char *str, size_t len)
+    {
+        std::string key(str, len);
+        std::map<std::string, uint64_t>::iterator it = offsets.find(key);
+        if (it == offsets.end()) {
+            it = offsets.insert(std::make_pair(key, (uint64_t)strings.size())).first;
+            strings.append(str, len);
+            strings.push_back('\0');
+        }
+        JsonTapeEntry entry = { (uint32_t)JsonTape::Kind::STRING, (uint32_t)len, it->second };
+        return entry;
     }
 
-    switch (*json)
+    static JsonTapeEntry Scalar(JsonValue value)
     {
-    case 'n':
-    case 't':
-    case 'f':
-        returnNode = new (_reservedPool.Alloc()) JsonReserved(this);
-        returnNode->_memPool = &_reservedPool;
-        break;
-    case '\"':
-        returnNode = new (_stringPool.Alloc()) JsonString(this);
-        returnNode->_memPool = &_stringPool;
-        ++json;
-        break;
-    case '{':
-        returnNode = new (_objectPool.Alloc()) JsonObject(this);
-        returnNode->_memPool = &_objectPool;
-        ++json;
-        break;
-    case '[':
-        returnNode = new (_arrayPool.Alloc()) JsonArray(this);
-        returnNode->_memPool = &_arrayPool;
-        ++json;
-        break;
-    case '-':
-    case '0':
-    case '1':
-    case '2':
-    case '3':
-    case '4':
-    case '5':
-    case '6':
-    case '7':
-    case '8':
-    case '9':
-        returnNode = new (_numberPool.Alloc()) JsonNumber(this);
-        returnNode->_memPool = &_numberPool;
-        break;
-    default:
-        break;
+        JsonTapeEntry entry = { (uint32_t)JsonTape::Kind::SCALAR, 0, value.Bits() };
+        return entry;
     }
 
-    *node = returnNode;
-    return json;
+    // Fills entries[slot]; the items of a container are added after everything so far.
+    void Write(const JsonNode *node, size_t slot)
+    {
+        if (node->ToString() != nullptr) {
+            entries[slot] = String(node->ToString()->CStr(), node->ToString()->Length());
+        } else if (const JsonArray *array = node->ToArray()) {
+            if (array->IsPacked()) {
+                uint64_t first = entries.size();
+                JsonTapeEntry entry = { (uint32_t)JsonTape::Kind::ARRAY, (uint32_t)array->PackedSize(), first };
+                entries[slot] = entry;
+                entries.resize(first + array->PackedSize());
+                for (int i = 0; i < array->PackedSize(); ++i) {
+                    entries[first + i] = Scalar(array->PackedAt(i));
+                }
+                return;
+            }
+            std::vector<const JsonNode *> items;
+            for (const JsonNode *child = array->FirstChild(); child; child = child->NextSibling()) {
+                items.push_back(child);
+            }
+            uint64_t first = entries.size();
+            JsonTapeEntry entry = { (uint32_t)JsonTape::Kind::ARRAY, (uint32_t)items.size(), first };
+            entries[slot] = entry;
+            entries.resize(first + items.size());
+            for (size_t i = 0; i < items.size(); ++i) {
+                Write(items[i], first + i);
+            }
+        } else if (const JsonObject *object = node->ToObject()) {
+            std::vector<const JsonElement *> members;
+            for (const JsonNode *child = object->FirstChild(); child; child = child->NextSibling()) {
+                const JsonElement *element = child->ToElement();
+                if (element != nullptr && element->Key() != nullptr && element->Value() != nullptr) {
+                    members.push_back(element);
+                }
+            }
+            std::stable_sort(members.begin(), members.end(), [](const JsonElement *a, const JsonElement *b) {
+                return CompareTapeKey(a->Key()->CStr(), a->Key()->Length(), b->Key()->CStr(), b->Key()->Length()) < 0;
+            });
+            // Duplicate keys keep their first value, like JsonObject::Find.
+            members.erase(std::unique(members.begin(), members.end(), [](const JsonElement *a, const JsonElement *b) {
+                return CompareTapeKey(a->Key()->CStr(), a->Key()->Length(), b->Key()->CStr(), b->Key()->Length()) == 0;
+            }), members.end());
+            uint64_t first = entries.size();
+            JsonTapeEntry entry = { (uint32_t)JsonTape::Kind::OBJECT, (uint32_t)members.size(), first };
+            entries[slot] = entry;
+            entries.resize(first + members.size() * 2);
+            for (size_t i = 0; i < members.size(); ++i) {
+                entries[first + i * 2] = String(members[i]->Key()->CStr(), members[i]->Key()->Length());
+                Write(members[i]->Value(), first + i * 2 + 1);
+            }
+        } else {
+            entries[slot] = Scalar(JsonValue::FromNode(node));
+        }
+    }
+};
 }
 
-JsonElement *JsonDocument::CreatElement()
+bool JsonTape::WriteSource(const JsonNode *node, const char *name, FILE *fp)
 {
-    JsonElement *node = new (_elementPool.Alloc()) JsonElement(this);
-    node->_memPool = &_elementPool;
-    return node;
-}
+    if (node != nullptr && node->ToDocument() != nullptr) {
+        node = node->FirstChild();
+    }
+    if (node == nullptr || node->ToElement() != nullptr || !node->MaterializeAll()) {
+        return false;
+    }
 
-JsonError JsonDocument::Parse(const char *json, size_t len)
-{
-    DeleteChildren();
-    InitDocument();
+    TapeBuilder builder;
+    builder.entries.resize(1);
+    builder.Write(node, 0);
 
-    if (json == nullptr || !*json) {
-        SetError(JsonError::JSON_ERROR_EMPTY_DOCUMENT, 0, 0);
-        return _errorID;
+    fprintf(fp, "static const tinyjson::JsonTapeEntry %s_entries[] = {\n", name);
+    for (size_t i = 0; i < builder.entries.size(); ++i) {
+        const JsonTapeEntry &entry = builder.entries[i];
+        fprintf(fp, "    { %u, %u, 0x%llxull },\n", (unsigned)entry.kind, (unsigned)entry.size,
+                (unsigned long long)entry.data);
     }
-    if (len == (size_t)(-1)) {
-        len = strlen(json);
+    fprintf(fp, "};\n\nstatic const char %s_strings[] =", name);
+    if (builder.strings.empty()) {
+        fprintf(fp, " \"\"");
     }
-    _charBuffer = new char[len + 1];
-    memcpy(_charBuffer, json, len);
-    _charBuffer[len] = 0;
-
-    json = JsonUtil::SkipWhiteSpace(json);
-    if (json == nullptr || !*json) {
-        SetError(JsonError::JSON_ERROR_EMPTY_DOCUMENT, 0, 0);
-        return _errorID;
+    // One string per line; octal escapes are always three digits so a following digit is
+    // not taken into them.
+    bool lineStart = true;
+    for (size_t i = 0; i < builder.strings.size(); ++i) {
+        unsigned char c = (unsigned char)builder.strings[i];
+        if (lineStart) {
+            fprintf(fp, "\n    \"");
+            lineStart = false;
+        }
+        if (c == 0) {
+            fprintf(fp, "\\000\"");
+            lineStart = true;
+        } else if (c < 0x20 || c >= 0x7F || c == '\"' || c == '\\' || c == '?') {
+            fprintf(fp, "\\%03o", c);
+        } else {
+            fputc(c, fp);
+        }
     }
+    fprintf(fp, ";\n\nstatic const tinyjson::JsonTape %s(%s_entries, %s_strings);\n", name, name, name);
+    return !ferror(fp);
+}
 
-    ParseDeep(_charBuffer);
-    return _errorID;
+/********************************************************************************************/
+
+bool JsonPrinter::VisitEnter(const JsonDocument &node)
+{
+    BeginNode(node);
+    return true;
 }
 
-bool JsonDocument::Accept(JsonVisitor *visitor) const
+bool JsonPrinter::VisitExit(const JsonDocument &node)
 {
-    for (const JsonNode *node = FirstChild(); node; node = node->NextSibling()) {
-        if (!node->Accept(visitor)) {
-            break;
-        }
-    }
+    EndNode(node);
     return true;
 }
 
 bool JsonPrinter::VisitEnter(const JsonObject &node)
 {
     PrintPrevSymbol(node);
-    _out.append("{\n");
+    Write(_options.pretty ? "{\n" : "{", _options.pretty ? 2 : 1);
     ++_depth;
     return true;
 }
 
 bool JsonPrinter::VisitExit(const JsonObject &node)
 {
-    _out.append("\n");
     --_depth;
-    PrintSpace(_depth);
-    _out.append("}");
+    if (_options.pretty) {
+        Write("\n", 1);
+        PrintSpace(_depth);
+    }
+    Write("}", 1);
+    EndNode(node);
     return true;
 }
 
 bool JsonPrinter::VisitEnter(const JsonArray &node)
 {
     PrintPrevSymbol(node);
-    _out.append("[\n");
+    Write(_options.pretty ? "[\n" : "[", _options.pretty ? 2 : 1);
     ++_depth;
+
+    char buffer[32];
+    const int64_t *ints = node.AsInt64Span();
+    for (int i = 0; i < node.PackedSize(); ++i) {
+        if (i > 0) {
+            Write(_options.pretty ? ",\n" : ",", _options.pretty ? 2 : 1);
+        }
+        PrintSpace(_depth);
+        if (ints != nullptr) {
+            Write(buffer, snprintf(buffer, sizeof(buffer), "%lld", (long long)ints[i]));
+        } else {
+            PrintValue(node.PackedAt(i));
+        }
+    }
     return true;
 }
 
+void JsonPrinter::PrintValue(JsonValue value)
+{
+    char buffer[32];
+    int len = 0;
+    switch (value.GetType()) {
+    case JsonValue::Type::VALUE_INT:
+        len = snprintf(buffer, sizeof(buffer), "%d", value.AsInt());
+        break;
+    case JsonValue::Type::VALUE_DOUBLE:
+        // JSON has no infinities or NaN; what overflowed when parsed, e.g. 1e400, becomes null.
+        if (value.AsDouble() - value.AsDouble() != 0) {
+            Write("null", 4);
+            return;
+        }
+        // Shortest of the two precisions that reads back as the same double.
+        len = snprintf(buffer, sizeof(buffer), "%.15g", value.AsDouble());
+        if (strtod(buffer, nullptr) != value.AsDouble()) {
+            len = snprintf(buffer, sizeof(buffer), "%.17g", value.AsDouble());
+        }
+        break;
+    case JsonValue::Type::VALUE_BOOL:
+        Write(value.AsBool() ? "true" : "false");
+        return;
+    case JsonValue::Type::VALUE_NULL:
+        Write("null", 4);
+        return;
+    default:
+        return;
+    }
+    Write(buffer, len);
+}
+
 bool JsonPrinter::VisitExit(const JsonArray &node)
 {
-    _out.append("\n");
     --_depth;
-    PrintSpace(_depth);
-    _out.append("]");
+    if (_options.pretty) {
+        Write("\n", 1);
+        PrintSpace(_depth);
+    }
+    Write("]", 1);
+    EndNode(node);
     return true;
 }
 
@@ -569,62 +3584,267 @@ bool JsonPrinter::VisitEnter(const JsonElement &node)
     return true;
 }
 
+bool JsonPrinter::VisitExit(const JsonElement &node)
+{
+    EndNode(node);
+    return true;
+}
+
 bool JsonPrinter::Visit(const JsonNumber &node)
 {
     PrintPrevSymbol(node);
-    std::ostringstream ss;
-    ss << node.GetValue();
-    _out += ss.str();
+    if (node.IsInt64()) {
+        char buffer[32];
+        Write(buffer, snprintf(buffer, sizeof(buffer), "%lld", (long long)node.GetInt64()));
+    } else {
+        PrintValue(JsonValue::Double(node.GetDouble()));
+    }
+    EndNode(node);
     return true;
 }
 
 bool JsonPrinter::Visit(const JsonString &node)
 {
     PrintPrevSymbol(node);
-
-    std::ostringstream ss;
-    ss << '\"'<<node.GetStr() << '\"';
-    _out += ss.str();
+    Write("\"", 1);
+    if (node.CStr() != nullptr) {
+        size_t (*cleanRun)(const char *, size_t, bool) = JsonKernels::Get().cleanRun;
+        const char *p = node.CStr();
+        size_t left = node.Length();
+        while (left > 0) {
+            size_t run = cleanRun(p, left, _options.asciiOnly);
+            Write(p, run);
+            p += run;
+            left -= run;
+            if (left > 0) {
+                size_t used = PrintEscape(p, left);
+                p += used;
+                left -= used;
+            }
+        }
+    }
+    Write("\"", 1);
+    EndNode(node);
     return true;
 }
 
+size_t JsonPrinter::PrintEscape(const char *p, size_t left)
+{
+    const unsigned char *s = reinterpret_cast<const unsigned char *>(p);
+    char buffer[16];
+    switch (s[0]) {
+    case '\"':
+        Write("\\\"", 2);
+        return 1;
+    case '\\':
+        Write("\\\\", 2);
+        return 1;
+    case '\b':
+        Write("\\b", 2);
+        return 1;
+    case '\f':
+        Write("\\f", 2);
+        return 1;
+    case '\n':
+        Write("\\n", 2);
+        return 1;
+    case '\r':
+        Write("\\r", 2);
+        return 1;
+    case '\t':
+        Write("\\t", 2);
+        return 1;
+    default:
+        break;
+    }
+    if (s[0] < 0x80) {
+        Write(buffer, snprintf(buffer, sizeof(buffer), "\\u%04x", s[0]));
+        return 1;
+    }
+
+    // Only reached with asciiOnly: decode one UTF-8 sequence. Anything malformed is written as
+    // U+FFFD one byte at a time; encoded surrogates are let through as the parser produces them.
+    uint32_t cp = 0xFFFD;
+    size_t used = 1;
+    size_t need = s[0] >= 0xF0 ? 4 : s[0] >= 0xE0 ? 3 : s[0] >= 0xC2 ? 2 : 0;
+    if (need != 0 && need <= left && s[0] < 0xF5) {
+        uint32_t value = s[0] & (0xFF >> (need + 1));
+        size_t i = 1;
+        for (; i < need && (s[i] & 0xC0) == 0x80; ++i) {
+            value = (value << 6) | (s[i] & 0x3F);
+        }
+        static const uint32_t minimum[] = { 0, 0, 0x80, 0x800, 0x10000 };
+        if (i == need && value >= minimum[need] && value <= 0x10FFFF) {
+            cp = value;
+            used = need;
+        }
+    }
+    if (cp >= 0x10000) {
+        cp -= 0x10000;
+        Write(buffer, snprintf(buffer, sizeof(buffer), "\\u%04x\\u%04x",
+            (unsigned)(0xD800 + (cp >> 10)), (unsigned)(0xDC00 + (cp & 0x3FF))));
+    } else {
+        Write(buffer, snprintf(buffer, sizeof(buffer), "\\u%04x", (unsigned)cp));
+    }
+    return used;
+}
+
 bool JsonPrinter::Visit(const JsonReserved &node)
 {
     PrintPrevSymbol(node);
     switch (node.GetType())
     {
     case JsonReserved::Type::RESERVED_NULL:
-        _out.append("null");
+        Write("null", 4);
         break;
     case JsonReserved::Type::RESERVED_TRUE:
-        _out.append("true");
+        Write("true", 4);
         break;
     case JsonReserved::Type::RESERVED_FALSE:
-        _out.append("flase");
+        Write("false", 5);
         break;
     default:
         break;
     }
+    EndNode(node);
+    return true;
+}
+
+bool JsonPrinter::Print(const JsonNode &node)
+{
+    // Otherwise a container failing to parse would just be left out of the output.
+    if (node.GetDocument()->HasLazyContent() && !node.MaterializeAll()) {
+        return false;
+    }
+    node.Accept(this);
+    return true;
+}
+
+size_t ComputeSerializedSize(const JsonNode &node, const WriterOptions &options)
+{
+    // Like Print, nothing for a subtree with a lazy container that fails to parse.
+    if (node.GetDocument()->HasLazyContent() && !node.MaterializeAll()) {
+        return 0;
+    }
+    JsonPrinter counter(nullptr, 0, options);
+    node.Accept(&counter);
+    return counter.Size();
+}
+
+bool JsonPrinter::ParallelPrint(const JsonNode &node, JsonThreadPool *pool, int minChildren)
+{
+    if (node.GetDocument()->HasLazyContent() && !node.MaterializeAll()) {
+        return false;
+    }
+    const JsonNode *container = &node;
+    const bool isDocument = node.ToDocument() != nullptr;
+    if (isDocument && node.FirstChild() != nullptr && node.FirstChild() == node.LastChild()) {
+        container = node.FirstChild();
+    }
+
+    DynArray< const JsonNode *, 64 > children;
+    for (const JsonNode *child = container->FirstChild(); child; child = child->NextSibling()) {
+        children.Push(child);
+    }
+    if (pool == nullptr || children.Size() < minChildren || children.Size() < 2) {
+        node.Accept(this);
+        return true;
+    }
+
+    const bool isContainer = container != &node || !isDocument;
+    if (isContainer && !VisitEnterNode(this, container)) {
+        VisitExitNode(this, container);
+        return true;
+    }
+    if (!isContainer) {
+        // The document isn't visited, but printing starts on it.
+        BeginNode(node);
+    }
+
+    // Separators and indentation only depend on a node's parent and previous sibling, so each
+    // range prints exactly what the serial walk would have printed for it.
+    int rangeCount = pool->ThreadCount() * 4;
+    if (rangeCount > children.Size()) {
+        rangeCount = children.Size();
+    }
+    JsonPrinter *printers = new JsonPrinter[rangeCount];
+    pool->ParallelFor(rangeCount, [&](int, int range) {
+        int begin = (int)((long long)children.Size() * range / rangeCount);
+        int end = (int)((long long)children.Size() * (range + 1) / rangeCount);
+        printers[range]._depth = _depth;
+        printers[range]._options = _options;
+        // Even the first child of a range is not the top level.
+        printers[range]._top = container;
+        for (int i = begin; i < end; ++i) {
+            children[i]->Accept(&printers[range]);
+        }
+    });
+
+    if (_toString) {
+        size_t total = _out.size();
+        for (int i = 0; i < rangeCount; ++i) {
+            total += printers[i]._out.size();
+        }
+        _out.reserve(total);
+    }
+    for (int i = 0; i < rangeCount; ++i) {
+        Write(printers[i]._out.data(), printers[i]._out.size());
+    }
+    delete[] printers;
+
+    if (isContainer) {
+        VisitExitNode(this, container);
+    } else {
+        EndNode(node);
+    }
     return true;
 }
 
 void JsonPrinter::PrintSpace(int depth)
 {
-    for (int i = 0; i < depth; ++i) {
-        _out.append("    ");
+    static const char spaces[] = "                                ";
+    if (!_options.pretty) {
+        return;
+    }
+    for (size_t left = (size_t)depth * _options.indent; left > 0; ) {
+        size_t len = left < sizeof(spaces) - 1 ? left : sizeof(spaces) - 1;
+        Write(spaces, len);
+        left -= len;
     }
 }
 
+void JsonPrinter::BeginNode(const JsonNode &node)
+{
+    if (_top == nullptr) {
+        _top = &node;
+        if (_toString || _buffer != nullptr) {
+            TJ_PROBE2(print__start, this, &node);
+        }
+    }
+}
+
+void JsonPrinter::EndNode(const JsonNode &node)
+{
+    if (&node == _top) {
+        _top = nullptr;
+        if (_toString || _buffer != nullptr) {
+            TJ_PROBE3(print__done, this, _size, !_toString && _size > _capacity);
+        }
+    }
+}
+
 void JsonPrinter::PrintPrevSymbol(const JsonNode &node)
 {
+    // The node printing started on is the top level, whatever its siblings.
+    BeginNode(node);
     const JsonNode *parent = node.Parent();
-    if (parent != nullptr && node.PreviousSibling() != nullptr) {
+    if (&node != _top && parent != nullptr && node.PreviousSibling() != nullptr) {
         if (parent->ToElement() != nullptr) {
-            _out.append(" : ");
+            Write(_options.pretty ? " : " : ":", _options.pretty ? 3 : 1);
             return;
         }
         else {
-            _out.append(",\n");
+            Write(_options.pretty ? ",\n" : ",", _options.pretty ? 2 : 1);
         }
     }
     if (node.ToElement() == nullptr) {
@@ -632,4 +3852,81 @@ void JsonPrinter::PrintPrevSymbol(const JsonNode &node)
     }
 }
 
+/********************************************************************************************/
+
+JsonThreadPool::JsonThreadPool(int threadCount) :
+    _task(nullptr),
+    _count(0),
+    _next(0),
+    _active(0),
+    _generation(0),
+    _stop(false)
+{
+    if (threadCount <= 0) {
+        threadCount = (int)std::thread::hardware_concurrency();
+    }
+    if (threadCount <= 0) {
+        threadCount = 1;
+    }
+    for (int i = 0; i < threadCount; ++i) {
+        _threads.push_back(std::thread(&JsonThreadPool::WorkerMain, this, i));
+    }
+}
+
+JsonThreadPool::~JsonThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stop = true;
+    }
+    _wake.notify_all();
+    for (size_t i = 0; i < _threads.size(); ++i) {
+        _threads[i].join();
+    }
+}
+
+void JsonThreadPool::ParallelFor(int count, const std::function<void(int, int)> &task)
+{
+    if (count <= 0) {
+        return;
+    }
+    std::unique_lock<std::mutex> lock(_mutex);
+    _task = &task;
+    _count = count;
+    _next = 0;
+    _active = ThreadCount();
+    ++_generation;
+    _wake.notify_all();
+    _done.wait(lock, [this] { return _active == 0; });
+    _task = nullptr;
+}
+
+void JsonThreadPool::WorkerMain(int worker)
+{
+    unsigned seen = 0;
+    for (;;) {
+        const std::function<void(int, int)> *task;
+        int count;
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _wake.wait(lock, [&] { return _stop || _generation != seen; });
+            if (_stop) {
+                return;
+            }
+            seen = _generation;
+            task = _task;
+            count = _count;
+        }
+
+        for (int index = _next++; index < count; index = _next++) {
+            (*task)(worker, index);
+        }
+
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (--_active == 0) {
+            _done.notify_all();
+        }
+    }
+}
+
 }//tinyjson
\ No newline at end of file
@@ -3,8 +3,16 @@
 #define TINYJSON_INCLUDED
 #include <ctype.h>
 #include <stdarg.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <string.h>
 #include <string>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
 
 #if defined( _DEBUG ) || defined( DEBUG ) || defined(__DEBUG__)
 #ifndef DEBUG
@@ -24,6 +32,32 @@
 #define TJASSERT( x )           {}
 #endif
 
+// Static tracepoints for perf and bpftrace, provider "tinyjson". Build with TINYJSON_USDT on a
+// system with <sys/sdt.h> to get them; an unattached probe costs one nop. Without it they are
+// not compiled at all.
+//   parse__start(doc, bytes)          parse__done(doc, nodes, error)
+//   pool__grow(pool, itemSize, fromRegion)
+//   print__start(printer, node)       print__done(printer, size, truncated)
+// nodes are those the parse created, per message for ParseBatch. The print probes fire around
+// the node a printer starts on, whether through Print, ParallelPrint or Accept, but not for a
+// printer that only counts. size is the printer's Size() so far, as a printer may print
+// several nodes.
+#if defined(TINYJSON_USDT)
+#include <sys/sdt.h>
+#define TJ_PROBE2( name, a, b )         DTRACE_PROBE2(tinyjson, name, a, b)
+#define TJ_PROBE3( name, a, b, c )      DTRACE_PROBE3(tinyjson, name, a, b, c)
+#else
+#define TJ_PROBE2( name, a, b )
+#define TJ_PROBE3( name, a, b, c )
+#endif
+
+// Deepest nesting of objects and arrays the parser accepts. It recurses once per level, so this
+// bounds its stack use on hostile input. Deeper documents fail with JSON_ERROR_DEPTH_EXCEEDED,
+// or with a mismatch error under ParseOptions::LAZY, whose skipping can't tell the two apart.
+#ifndef TINYJSON_MAX_DEPTH
+#define TINYJSON_MAX_DEPTH 1000
+#endif
+
 namespace tinyjson
 {
 class JsonNumber;
@@ -34,7 +68,37 @@ class JsonArray;
 class JsonDocument;
 class JsonNode;
 class JsonReserved;
-
+class JsonThreadPool;
+class JsonArena;
+
+
+// Flags for JsonDocument::SetParseOptions.
+struct ParseOptions {
+    enum : unsigned {
+        NONE = 0,
+        // Arrays holding only numbers keep them in one int64_t or double buffer instead of a
+        // JsonNumber node per value; see JsonArray::IsPacked.
+        PACK_NUMBERS = 1 << 0,
+        // Like PACK_NUMBERS, and arrays mixing numbers with true, false and null are kept as one
+        // JsonValue buffer.
+        PACK_SCALARS = 1 << 1,
+        // Objects and arrays only record where their contents are and parse them on first
+        // access to their children; see JsonNode::FirstChild. Since that access may be through
+        // a const reader, the document must not be read from several threads until
+        // MaterializeAll has run.
+        LAZY = 1 << 2,
+        // Strings of at most JsonDocument::DEDUP_MAX_LENGTH bytes, keys included, share one
+        // copy per distinct value; see JsonString::SameAs.
+        DEDUP_STRINGS = 1 << 3,
+        // The input is known to be valid JSON, e.g. from a trusted service: Parse and LoadFile
+        // use a leaner parser that only checks what keeps it inside the buffer. Invalid input
+        // gives an error or a wrong tree.
+        TRUSTED = 1 << 4,
+        // TRUSTED, with no whitespace between tokens either, so none is looked for. Whitespace
+        // before and after the document is fine.
+        TRUSTED_MINIFIED = TRUSTED | 1 << 5,
+    };
+};
 
 enum class JsonError {
     JSON_NO_ERROR = 0,
@@ -53,6 +117,7 @@ enum class JsonError {
     JSON_ERROR_PARSING,
 
     JSON_ERROR_EMPTY_DOCUMENT,
+    JSON_ERROR_DEPTH_EXCEEDED,
 };
 
 class JsonUtil
@@ -97,6 +162,78 @@ public:
     {
         return (anyByte < 128) ? isalpha(anyByte) : 1;
     }
+
+    // First '"', '\\' or nul at or after p.
+    static const char *ScanString(const char *p)
+    {
+        while (*p != '\"' && *p != '\\' && *p) {
+            ++p;
+        }
+        return p;
+    }
+    static bool IsValidUTF8(const char *p, size_t len);
+    // Length of the longest prefix of [p, p + len) that needs no escaping in JSON output: no
+    // '"', '\\' or control characters, nor with asciiOnly any byte from 0x80 up.
+    static size_t CleanRun(const char *p, size_t len, bool asciiOnly);
+    // Decodes the escape sequences in [start, end) in place and returns the new end, or null
+    // on a malformed escape. A \u escape of a lone surrogate becomes its 3-byte encoding.
+    static char *UnescapeString(char *start, char *end);
+    // Writes the offsets of every '{', '}', '[', ']', ':', ',', '"' and '\\' in [p, p + len) to
+    // out, which must have room for len entries, and returns how many were written. String
+    // contents are not masked out; the quotes and backslashes let the caller do that.
+    static size_t IndexStructurals(const char *p, size_t len, uint32_t *out);
+    // Parses a number in strict JSON syntax. Returns the end of the number, or null if p does not
+    // start one. *isInt is set when the text has no fraction or exponent and fits in an int64_t,
+    // except for -0, which only a double keeps.
+    // Reads up to 8 bytes past the end of the digits, see JsonDocument::BUFFER_PADDING.
+    static const char *ParseNumber(const char *p, bool *isInt, int64_t *intValue, double *doubleValue);
+    // p is just past an opening '{' or '['. Returns the position after the bracket that
+    // closes it, or null if there is none or the nesting goes deeper than TINYJSON_MAX_DEPTH.
+    // Only nesting and strings are looked at.
+    static char *SkipContainer(char *p);
+};
+
+// Table of the scanning routines the parser spends its time in, with one implementation per
+// x86 instruction set level. The best level the CPU supports is picked on first use; setting
+// TINYJSON_KERNEL to scalar, sse2, sse42, avx2 or avx512 (or calling Force) overrides it. The
+// scalar set is the JsonUtil routines and is the reference every other set must match;
+// tinyJsonBench kernels checks that they do. The parser uses skipWhiteSpace and scanString and
+// the printer cleanRun; validateUTF8 and indexStructurals are there for callers.
+// The SIMD versions of SkipWhiteSpace and ScanString may read the rest of the aligned block
+// holding the terminating nul, which never crosses a page.
+class JsonKernels
+{
+public:
+    enum class Level {
+        SCALAR = 0,
+        SSE2,
+        SSE42,
+        AVX2,
+        AVX512
+    };
+
+    Level level;
+    const char *name;
+    const char *(*skipWhiteSpace)(const char *p);
+    const char *(*scanString)(const char *p);
+    bool (*validateUTF8)(const char *p, size_t len);
+    size_t (*indexStructurals)(const char *p, size_t len, uint32_t *out);
+    size_t (*cleanRun)(const char *p, size_t len, bool asciiOnly);
+
+    static const JsonKernels &Get()
+    {
+        const JsonKernels *kernels = _active.load(std::memory_order_acquire);
+        return kernels != nullptr ? *kernels : Init();
+    }
+    // Selects kernels by name; null or "auto" selects the best supported set. Returns false,
+    // leaving the selection alone, if the name is unknown or the CPU lacks the instructions.
+    static bool Force(const char *name);
+    static Level Detect();
+    static const JsonKernels *Find(Level level);
+
+private:
+    static const JsonKernels &Init();
+    static std::atomic<const JsonKernels *> _active;
 };
 
 class StrPair
@@ -121,13 +258,26 @@ public:
         if (_start == nullptr || _end == nullptr || _start == _end) {
             return str;
         }
-        str = _start;
+        str.assign(_start, _end);
         return str;
     }
 
     bool Empty() const {
         return _start == _end;
     }
+
+    const char *Start() const
+    {
+        return _start;
+    }
+    size_t Length() const
+    {
+        return _end - _start;
+    }
+    bool Equals(const char *str, size_t len) const
+    {
+        return Length() == len && !memcmp(_start, str, len);
+    }
 private:
     void Reset()
     {
@@ -172,6 +322,27 @@ public:
         return ret;
     }
 
+    void Clear()
+    {
+        _size = 0;
+    }
+
+    void Swap(DynArray &other)
+    {
+        DynArray tmp;
+        for (int i = 0; i < _size; ++i) {
+            tmp.Push(_mem[i]);
+        }
+        Clear();
+        for (int i = 0; i < other._size; ++i) {
+            Push(other._mem[i]);
+        }
+        other.Clear();
+        for (int i = 0; i < tmp._size; ++i) {
+            other.Push(tmp._mem[i]);
+        }
+    }
+
     T Pop() 
     {
         return _mem[--_size];
@@ -242,6 +413,43 @@ private:
 };
 
 
+// Fixed block of memory handed out front to back, for documents that must not use the heap.
+// Alloc returns null once it is used up; Reset makes all of it available again.
+class MemRegion
+{
+public:
+    MemRegion() : _mem(nullptr), _size(0), _used(0) {}
+    MemRegion(void *mem, size_t size) : _mem((char *)mem), _size(size), _used(0) {}
+
+    void *Alloc(size_t size, size_t align)
+    {
+        size_t pad = (size_t)(-(intptr_t)(_mem + _used)) & (align - 1);
+        if (pad + size > _size - _used) {
+            return nullptr;
+        }
+        void *result = _mem + _used + pad;
+        _used += pad + size;
+        return result;
+    }
+    void Reset()
+    {
+        _used = 0;
+    }
+    size_t Capacity() const
+    {
+        return _size;
+    }
+    size_t Used() const
+    {
+        return _used;
+    }
+
+private:
+    char *_mem;
+    size_t _size;
+    size_t _used;
+};
+
 class MemPool
 {
 public:
@@ -249,6 +457,7 @@ public:
     virtual ~MemPool() {}
 
     virtual int ItemSize() const = 0;
+    // Null only for a pool drawing from a full MemRegion.
     virtual void *Alloc() = 0;
     virtual void Free(void *) = 0;
 #ifdef DEBUG
@@ -261,6 +470,7 @@ class MemPoolT : public MemPool
 {
 public:
     MemPoolT() : _root(0)
+        , _region(nullptr)
         , _currentAllocs(0)
         , _nAllocs(0)
         , _maxAllocs(0)
@@ -288,8 +498,18 @@ public:
     virtual void *Alloc() 
     {
         if (_root == nullptr) {
-            Block *block = new Block();
-            _blockPtrs.Push(block);
+            Block *block;
+            if (_region != nullptr) {
+                // Not kept in _blockPtrs; the region owns it.
+                block = static_cast<Block *>(_region->Alloc(sizeof(Block), alignof(Block)));
+                if (block == nullptr) {
+                    return nullptr;
+                }
+            } else {
+                block = new Block();
+                _blockPtrs.Push(block);
+            }
+            TJ_PROBE3(pool__grow, this, SIZE, _region != nullptr);
 
             for (int i = 0; i < COUNT - 1; ++i) {
                 block->chunk[i].next = &block->chunk[i + 1];
@@ -324,6 +544,32 @@ public:
         chunk->next = _root;
         _root = chunk;
     }
+    // Exchanges all blocks and counters; for handing over a freshly filled pool.
+    void Swap(MemPoolT &other)
+    {
+        _blockPtrs.Swap(other._blockPtrs);
+        std::swap(_root, other._root);
+        std::swap(_currentAllocs, other._currentAllocs);
+        std::swap(_nAllocs, other._nAllocs);
+        std::swap(_maxAllocs, other._maxAllocs);
+#ifdef DEBUG
+        std::swap(_nUntracked, other._nUntracked);
+#endif
+    }
+
+    // Takes new blocks from region instead of the heap.
+    void SetRegion(MemRegion *region)
+    {
+        _region = region;
+    }
+    // Forgets the blocks taken from the region, before the region is reset. Nothing may be
+    // allocated from the pool at that point.
+    void ResetRegion()
+    {
+        TJASSERT(_currentAllocs == 0);
+        _root = nullptr;
+    }
+
     void Trace(const char *name) 
     {
         printf("Mempool %s watermark=%d [%dk] current=%d size=%d nAlloc=%d blocks=%d\n",
@@ -352,6 +598,7 @@ private:
     };
     DynArray< Block *, 10 > _blockPtrs;
     Chunk *_root;
+    MemRegion *_region;
 
     int _currentAllocs;
     int _nAllocs;
@@ -361,11 +608,227 @@ private:
 #endif
 };
 
+// Bump allocator for variable sized data (string copies and the like). Memory is only
+// returned all at once, by Clear or the destructor.
+class MemArena
+{
+public:
+    MemArena() : _nextBlock(0), _current(nullptr), _left(0), _region(nullptr) {}
+    ~MemArena()
+    {
+        Clear();
+    }
+
+    // Null only for an arena drawing from a full MemRegion.
+    void *Alloc(size_t size, size_t align = sizeof(void *));
+    // Nul-terminated copy of len bytes of str.
+    char *StrDup(const char *str, size_t len);
+    void Clear();
+    // Frees everything like Clear, but keeps the blocks to fill again, so an arena that is reused
+    // for the same work stops going to the heap. Big blocks that go unused until the next Reset
+    // are released then.
+    void Reset();
+    // Allocates straight from region instead of heap blocks.
+    void SetRegion(MemRegion *region)
+    {
+        _region = region;
+    }
+    void Swap(MemArena &other)
+    {
+        _blockPtrs.Swap(other._blockPtrs);
+        _bigBlocks.Swap(other._bigBlocks);
+        _spareBlocks.Swap(other._spareBlocks);
+        std::swap(_nextBlock, other._nextBlock);
+        std::swap(_current, other._current);
+        std::swap(_left, other._left);
+    }
+
+    enum { BLOCK_SIZE = 4096 };
+
+private:
+    struct BigBlock {
+        char *mem;
+        size_t size;
+    };
+    char *AllocBig(size_t size);
+
+    // Regular BLOCK_SIZE blocks, of which the first _nextBlock are in use; blocks of single big
+    // requests, and those kept by Reset for reuse.
+    DynArray< char *, 10 > _blockPtrs;
+    DynArray< BigBlock, 4 > _bigBlocks;
+    DynArray< BigBlock, 4 > _spareBlocks;
+    int _nextBlock;
+    char *_current;
+    size_t _left;
+    MemRegion *_region;
+};
+
+// Interns strings into a MemArena: every distinct string is copied once, and interning an
+// equal string again returns that same copy.
+class StrTable
+{
+public:
+    explicit StrTable(MemArena *arena) : _arena(arena), _slots(nullptr), _capacity(0), _size(0) {}
+    ~StrTable()
+    {
+        delete[] _slots;
+    }
+
+    // Nul-terminated copy of [str, str + len) shared with all equal strings.
+    const char *Intern(const char *str, size_t len);
+    void Clear();
+    // Exchanges the entries; each table keeps its arena.
+    void Swap(StrTable &other)
+    {
+        std::swap(_slots, other._slots);
+        std::swap(_capacity, other._capacity);
+        std::swap(_size, other._size);
+    }
+    int Size() const
+    {
+        return _size;
+    }
+
+private:
+    struct Slot {
+        const char *str;
+        size_t len;
+        uint32_t hash;
+    };
+    void Grow();
+
+    MemArena *_arena;
+    Slot *_slots;
+    int _capacity;
+    int _size;
+};
+
+// 8-byte handle for a JSON value. A double is stored as itself (NaNs in one canonical form);
+// everything else lives in the payload of a negative quiet NaN: null, booleans and 32-bit
+// integers inline, strings and containers as a pointer to their node.
+class JsonValue
+{
+public:
+    enum class Type {
+        VALUE_DOUBLE = 0,
+        VALUE_INT,
+        VALUE_NULL,
+        VALUE_BOOL,
+        VALUE_NODE
+    };
+
+    JsonValue() : _bits(TAG_NULL) {}
+
+    static JsonValue Null()
+    {
+        return JsonValue(TAG_NULL);
+    }
+    static JsonValue Bool(bool value)
+    {
+        return JsonValue(TAG_BOOL | (value ? 1 : 0));
+    }
+    static JsonValue Int(int32_t value)
+    {
+        return JsonValue(TAG_INT | (uint32_t)value);
+    }
+    static JsonValue Double(double value)
+    {
+        uint64_t bits;
+        memcpy(&bits, &value, sizeof(bits));
+        return JsonValue(value != value ? CANONICAL_NAN : bits);
+    }
+    // Int when the value fits in 32 bits, a double otherwise.
+    static JsonValue Number(int64_t value)
+    {
+        return value == (int32_t)value ? Int((int32_t)value) : Double((double)value);
+    }
+    static JsonValue Node(const JsonNode *node)
+    {
+        return JsonValue(TAG_NODE | (uint64_t)(uintptr_t)node);
+    }
+    // Numbers, true, false and null come back inline; anything else as its node.
+    static JsonValue FromNode(const JsonNode *node);
+
+    Type GetType() const
+    {
+        if ((_bits & TAG_MASK) < TAG_INT) {
+            return Type::VALUE_DOUBLE;
+        }
+        switch (_bits & TAG_MASK) {
+        case TAG_INT:
+            return Type::VALUE_INT;
+        case TAG_NULL:
+            return Type::VALUE_NULL;
+        case TAG_BOOL:
+            return Type::VALUE_BOOL;
+        default:
+            return Type::VALUE_NODE;
+        }
+    }
+    bool IsNumber() const
+    {
+        return (_bits & TAG_MASK) <= TAG_INT;
+    }
+    double AsDouble() const
+    {
+        if ((_bits & TAG_MASK) == TAG_INT) {
+            return (double)AsInt();
+        }
+        double value;
+        memcpy(&value, &_bits, sizeof(value));
+        return value;
+    }
+    int32_t AsInt() const
+    {
+        return (int32_t)(uint32_t)_bits;
+    }
+    bool AsBool() const
+    {
+        return (_bits & 1) != 0;
+    }
+    const JsonNode *AsNode() const
+    {
+        return GetType() == Type::VALUE_NODE ? (const JsonNode *)(uintptr_t)(_bits & PAYLOAD_MASK) : nullptr;
+    }
+    uint64_t Bits() const
+    {
+        return _bits;
+    }
+    // Inverse of Bits, for values stored elsewhere such as a JsonTape.
+    static JsonValue FromBits(uint64_t bits)
+    {
+        return JsonValue(bits);
+    }
+
+private:
+    explicit JsonValue(uint64_t bits) : _bits(bits) {}
+
+    // Tags are the top 16 bits. Real negative NaNs all have the top bits 0xFFF8 once
+    // canonicalized, so 0xFFF9 and up are free.
+    static const uint64_t TAG_MASK = 0xFFFF000000000000ull;
+    static const uint64_t PAYLOAD_MASK = 0x0000FFFFFFFFFFFFull;
+    static const uint64_t CANONICAL_NAN = 0x7FF8000000000000ull;
+    static const uint64_t TAG_INT = 0xFFF9000000000000ull;
+    static const uint64_t TAG_NULL = 0xFFFA000000000000ull;
+    static const uint64_t TAG_BOOL = 0xFFFB000000000000ull;
+    static const uint64_t TAG_NODE = 0xFFFC000000000000ull;
+
+    uint64_t _bits;
+};
+
 class JsonVisitor
 {
 public:
     virtual ~JsonVisitor() {}
 
+    virtual bool VisitEnter(const JsonDocument &)
+    {
+        return true;
+    }
+    virtual bool VisitExit(const JsonDocument &)
+    {
+        return true;
+    }
     virtual bool VisitEnter(const JsonObject &)
     {
         return true;
@@ -406,9 +869,27 @@ public:
     }
 };
 
+// Hands out one visitor per work unit of JsonNode::ParallelAccept and merges them afterwards.
+class JsonVisitorFactory
+{
+public:
+    virtual ~JsonVisitorFactory() {}
+
+    // May be called from any worker thread.
+    virtual JsonVisitor *Create() = 0;
+    // Called on the thread that called ParallelAccept, once per created visitor, in document order.
+    virtual void Reduce(JsonVisitor *visitor) = 0;
+    virtual void Destroy(JsonVisitor *visitor)
+    {
+        delete visitor;
+    }
+};
+
 class JsonNode
 {
     friend JsonDocument;
+    friend JsonObject;
+    friend JsonArena;
 public:
     static inline void DeleteNode(JsonNode *node)
     {
@@ -422,12 +903,18 @@ public:
     virtual char *ParseDeep(char *json);
     void DeleteChildren();
     JsonNode *InsertEndChild(JsonNode *addThis);
+    // Under ParseOptions::LAZY the first call on a container parses its direct children; errors
+    // found then are reported by JsonDocument::ErrorID, the container reads as empty and its
+    // Accept returns false without visiting it. The const readers (FirstChild, LastChild,
+    // JsonObject::Find) modify the tree then, so two threads must not make them race.
     const JsonNode *FirstChild() const
     {
+        EnsureParsed();
         return _firstChild;
     }
     JsonNode *FirstChild()
     {
+        EnsureParsed();
         return _firstChild;
     }
     const JsonNode *NextSibling() const
@@ -440,6 +927,7 @@ public:
     }
     const JsonNode *LastChild() const
     {
+        EnsureParsed();
         return _lastChild;
     }
 
@@ -470,6 +958,10 @@ public:
     {
         return _memPool;
     }
+    const JsonDocument *GetDocument() const
+    {
+        return _document;
+    }
     virtual JsonElement *ToElement()
     {
         return 0;
@@ -494,10 +986,65 @@ public:
     {
         return 0;
     }
+    virtual JsonDocument *ToDocument()
+    {
+        return 0;
+    }
+    virtual const JsonDocument *ToDocument() const
+    {
+        return 0;
+    }
+    virtual JsonNumber *ToNumber()
+    {
+        return 0;
+    }
+    virtual const JsonNumber *ToNumber() const
+    {
+        return 0;
+    }
+    virtual JsonString *ToString()
+    {
+        return 0;
+    }
+    virtual const JsonString *ToString() const
+    {
+        return 0;
+    }
+    virtual JsonReserved *ToReserved()
+    {
+        return 0;
+    }
+    virtual const JsonReserved *ToReserved() const
+    {
+        return 0;
+    }
     virtual bool Accept(JsonVisitor *visitor) const = 0;
+
+    // Parses every lazy container below this node, after which the subtree can be read from
+    // several threads at once. False if one of them fails to parse.
+    bool MaterializeAll() const;
+
+    // Like Accept, but the children of this node (of the root, when called on a document with a
+    // single root) are split into contiguous ranges that are visited on the pool, each by its own
+    // visitor from the factory. The container's VisitEnter goes to the first range's visitor and
+    // its VisitExit to the last one's. A visitor returning false only stops its own range.
+    // Containers with fewer than minChildren children are visited by a single visitor. Returns
+    // false, having visited nothing, when a lazy container below fails to parse.
+    bool ParallelAccept(JsonVisitorFactory *factory, JsonThreadPool *pool, int minChildren = 1024) const;
 protected:
     JsonNode(JsonDocument *);
     virtual ~JsonNode();
+    // Under ParseOptions::LAZY: records where the contents start, skips to the end.
+    char *ParseLazy(char *json);
+    bool EnsureParsed() const
+    {
+        return _lazy == nullptr || Materialize();
+    }
+    // Parses the contents of a container whose opening bracket has been consumed.
+    virtual char *ParseContent(char *json)
+    {
+        return json;
+    }
     JsonDocument *_document;
 
     JsonNode *_parent;
@@ -509,8 +1056,11 @@ protected:
 
 private:
     MemPool *_memPool;
+    // Start of the unparsed contents of a lazy container, null once parsed.
+    char *_lazy;
 
     void Unlink(JsonNode *child);
+    bool Materialize() const;
 
 };
 
@@ -518,6 +1068,7 @@ private:
 class JsonReserved :public JsonNode
 {
     friend JsonDocument;
+    friend JsonArena;
 public:
     enum class Type {
         RESERVED = 0,
@@ -531,6 +1082,14 @@ public:
         return _type;
     }
     char *ParseDeep(char *json) override;
+    virtual JsonReserved *ToReserved()
+    {
+        return this;
+    }
+    virtual const JsonReserved *ToReserved() const
+    {
+        return this;
+    }
     virtual bool Accept(JsonVisitor *visitor) const;
 private:
     JsonReserved(JsonDocument *doc);
@@ -542,30 +1101,85 @@ private:
 class JsonNumber : public JsonNode
 {
     friend JsonDocument;
+    friend JsonArena;
 public:
     float GetValue() const
     {
-        return _valueFloat;
+        return (float)GetDouble();
+    }
+    // The value as parsed, exact for integers up to 2^53.
+    double GetDouble() const
+    {
+        return _isInt ? (double)_valueInt : _valueDouble;
+    }
+    // Exact for any integer that fits in int64_t; other values are truncated toward zero and
+    // clamped to the int64_t range.
+    int64_t GetInt64() const;
+    // Whether the number was an integer that fits in int64_t (and not -0), so GetInt64 is it.
+    bool IsInt64() const
+    {
+        return _isInt;
     }
     char *ParseDeep(char *json) override;
+    virtual JsonNumber *ToNumber()
+    {
+        return this;
+    }
+    virtual const JsonNumber *ToNumber() const
+    {
+        return this;
+    }
     virtual bool Accept(JsonVisitor *visitor) const;
 private:
     JsonNumber(JsonDocument *doc);
     ~JsonNumber();
 
-    int _valueInt;
-    float _valueFloat;
+    void SetInt(int64_t value);
+    void SetDouble(double value);
+
+    union {
+        int64_t _valueInt;
+        double _valueDouble;
+    };
+    bool _isInt;
 };
 
 class JsonString : public JsonNode
 {
     friend JsonDocument;
+    friend JsonArena;
 public:
     const std::string GetStr() const
     {
         return _str.GetStr();
     }
+    const char *CStr() const
+    {
+        return _str.Start();
+    }
+    size_t Length() const
+    {
+        return _str.Length();
+    }
+    bool Equals(const char *str) const
+    {
+        return _str.Equals(str, strlen(str));
+    }
+    // Deduplicated strings of one document share storage, so equal ones are found by the
+    // pointer check alone.
+    bool SameAs(const JsonString &other) const
+    {
+        return CStr() == other.CStr() || _str.Equals(other.CStr(), other.Length());
+    }
     char *ParseDeep(char *json) override;
+    virtual JsonString *ToString()
+    {
+        return this;
+    }
+    virtual const JsonString *ToString() const
+    {
+        return this;
+    }
     virtual bool Accept(JsonVisitor *visitor) const;
 private:
     JsonString(JsonDocument *doc);
@@ -578,6 +1192,7 @@ private:
 class JsonElement : public JsonNode
 {
     friend JsonDocument;
+    friend JsonArena;
 public:
     char *ParseDeep(char *json) override;
     virtual JsonElement *ToElement()
@@ -589,14 +1204,51 @@ public:
         return this;
     }
     virtual bool Accept(JsonVisitor *visitor) const;
+
+    const JsonString *Key() const
+    {
+        return FirstChild() != nullptr ? FirstChild()->ToString() : nullptr;
+    }
+    const JsonNode *Value() const
+    {
+        return FirstChild() != nullptr ? FirstChild()->NextSibling() : nullptr;
+    }
+    JsonNode *Value()
+    {
+        return FirstChild() != nullptr ? FirstChild()->NextSibling() : nullptr;
+    }
 private:
     JsonElement(JsonDocument *doc);
     virtual ~JsonElement();
 };
 
+// Caller-held lookup cache for one key, for reading that key from many objects of the same
+// shape: JsonObject::Find tries the member position where it was found last time before
+// searching. Only frozen objects (JsonDocument::Freeze) get a real fast path, where a hit is
+// one key compare. On other objects a hit still walks the members up to that position and
+// saves only the key compares on the way. The key is not copied.
+class JsonLookupCache
+{
+    friend JsonObject;
+public:
+    explicit JsonLookupCache(const char *key);
+    const char *Key() const
+    {
+        return _key;
+    }
+private:
+    const char *_key;
+    size_t _length;
+    uint64_t _prefix;
+    int _slot;
+};
+
 class JsonObject : public JsonNode
 {
+    friend JsonNode;
     friend JsonDocument;
+    friend JsonArena;
+    friend JsonLookupCache;
 public:
     char *ParseDeep(char *json) override; 
     virtual JsonObject *ToObject()
@@ -608,17 +1260,58 @@ public:
         return this;
     }
     virtual bool Accept(JsonVisitor *visitor) const;
+
+    // Value of the first member whose key is key, or null. A binary search once the object
+    // is frozen, a walk over the members otherwise.
+    const JsonNode *Find(const char *key) const;
+    JsonNode *Find(const char *key)
+    {
+        return const_cast<JsonNode *>(const_cast<const JsonObject *>(this)->Find(key));
+    }
+    // Like Find(cache->Key()), checking the cached position first and updating it. Where an
+    // object that is not frozen repeats a key, a hit may return a later member than Find.
+    const JsonNode *Find(JsonLookupCache *cache) const;
+    JsonNode *Find(JsonLookupCache *cache)
+    {
+        return const_cast<JsonNode *>(const_cast<const JsonObject *>(this)->Find(cache));
+    }
+    // Whether JsonDocument::Freeze sorted the members. Adding or removing a child unfreezes.
+    bool IsFrozen() const
+    {
+        return _members != nullptr;
+    }
 private:
     JsonObject(JsonDocument *doc);
     virtual ~JsonObject();
 
+    char *ParseContent(char *json) override;
     char *ParseElement(char *json);
 
+    // Sorted by key: the first 8 bytes as a big-endian integer, then the rest of the key.
+    struct Member {
+        uint64_t prefix;
+        const JsonElement *element;
+    };
+    static uint64_t KeyPrefix(const char *key, size_t len);
+    static int CompareKey(const Member &member, uint64_t prefix, const char *key, size_t len);
+    int LowerBound(uint64_t prefix, const char *key, size_t len) const;
+    void Index(MemArena *arena);
+    void Freeze(MemArena *arena);
+    void Unfreeze()
+    {
+        _members = nullptr;
+        _memberCount = 0;
+    }
+
+    Member *_members;
+    int _memberCount;
+
 };
 
 class JsonArray : public JsonNode
 {
     friend JsonDocument;
+    friend JsonArena;
 public:
     char *ParseDeep(char *json) override;
     virtual JsonArray *ToArray()
@@ -631,32 +1324,253 @@ public:
     }
     virtual bool Accept(JsonVisitor *visitor) const;
 
+    enum class Packing {
+        NONE = 0,
+        PACKED_INT64,
+        PACKED_DOUBLE,
+        PACKED_VALUE
+    };
+
+    // A packed array (see ParseOptions::PACK_NUMBERS) has no child nodes; its values are only
+    // available through the spans below.
+    bool IsPacked() const
+    {
+        return GetPacking() != Packing::NONE;
+    }
+    Packing GetPacking() const
+    {
+        EnsureParsed();
+        return _packing;
+    }
+    int PackedSize() const
+    {
+        EnsureParsed();
+        return _packedSize;
+    }
+    // Null unless the array is packed with that element type.
+    const int64_t *AsInt64Span() const
+    {
+        return GetPacking() == Packing::PACKED_INT64 ? static_cast<const int64_t *>(_packedData) : nullptr;
+    }
+    const double *AsDoubleSpan() const
+    {
+        return GetPacking() == Packing::PACKED_DOUBLE ? static_cast<const double *>(_packedData) : nullptr;
+    }
+    const JsonValue *AsValueSpan() const
+    {
+        return GetPacking() == Packing::PACKED_VALUE ? static_cast<const JsonValue *>(_packedData) : nullptr;
+    }
+    // Element i of a packed array of any kind.
+    JsonValue PackedAt(int i) const;
+
+    // Child node i, or null if out of range or the array is packed. Walks the children.
+    const JsonNode *At(int index) const;
+    JsonNode *At(int index)
+    {
+        return const_cast<JsonNode *>(const_cast<const JsonArray *>(this)->At(index));
+    }
+
 private:
     JsonArray(JsonDocument *doc);
     virtual ~JsonArray();
+
+    char *ParseContent(char *json) override;
+    char *ParsePacked(char *json);
+
+    Packing _packing;
+    int _packedSize;
+    void *_packedData;
 };
 
+// Called once per file from ParseFiles, on the worker thread that parsed it. The document
+// belongs to that worker and is reused for its next file, so it is only valid during the call.
+typedef std::function<void(int index, JsonDocument *doc, JsonError error)> JsonFileCallback;
+
 class JsonDocument : public JsonNode
 {
+    friend JsonNode;
+    friend JsonObject;
+    friend JsonArray;
+    friend JsonString;
 public:
-    JsonDocument();
+    explicit JsonDocument(unsigned parseOptions = ParseOptions::NONE);
     ~JsonDocument();
 
+    // Parse options apply to every later Parse, LoadFile and ParseBatch.
+    // Options that need heap scratch space are dropped by a StaticJsonDocument.
+    void SetParseOptions(unsigned parseOptions)
+    {
+        _parseOptions = _region.Capacity() != 0 ? parseOptions & ~HEAP_OPTIONS : parseOptions;
+    }
+    unsigned GetParseOptions() const
+    {
+        return _parseOptions;
+    }
+    // Whether the last parse left containers unparsed (ParseOptions::LAZY), whatever the options
+    // are now.
+    bool HasLazyContent() const
+    {
+        return _hasLazyContent;
+    }
+
+    // Zero bytes kept after the terminating nul of the parse buffer, so the scanning and number
+    // kernels can read whole words without checking for the end.
+    enum { BUFFER_PADDING = 64 };
+    // Longest string shared by ParseOptions::DEDUP_STRINGS.
+    enum { DEDUP_MAX_LENGTH = 32 };
+
     char *Identify(char *json, JsonNode **node);
     JsonElement *CreatElement();
 
     JsonError Parse(const char *json, size_t nBytes = (size_t)(-1));
+    JsonError LoadFile(const char *filename);
+    JsonError LoadFile(FILE *fp);
+
+    // Parses count files on the pool, one reusable document per worker thread, each with
+    // parseOptions.
+    static void ParseFiles(const char *const *paths, int count, JsonThreadPool *pool,
+        const JsonFileCallback &callback, unsigned parseOptions = ParseOptions::NONE);
+
+    // Parses count independent messages into this document. All messages share one char
+    // buffer and the node pools; each becomes a root child of the document. lens may be
+    // null for nul-terminated messages. Returns the first error, per-message errors are
+    // available from BatchError. The batch is forgotten by the next Parse, LoadFile or
+    // DeleteChildren.
+    JsonError ParseBatch(const char *const *jsons, const size_t *lens, int count);
+    int BatchSize() const
+    {
+        return _batch.Size();
+    }
+    // Root of message i, or null if that message failed to parse.
+    const JsonNode *BatchRoot(int i) const
+    {
+        return _batch[i].root;
+    }
+    JsonNode *BatchRoot(int i)
+    {
+        return _batch[i].root;
+    }
+    JsonError BatchError(int i) const
+    {
+        return _batch[i].error;
+    }
 
     inline void SetError(JsonError error, const char *str1, const char *str2);
+    // First error since the last parse, including ones found while parsing lazy containers.
+    JsonError ErrorID() const
+    {
+        return _errorID;
+    }
+    virtual JsonDocument *ToDocument()
+    {
+        return this;
+    }
+    virtual const JsonDocument *ToDocument() const
+    {
+        return this;
+    }
     virtual bool Accept(JsonVisitor *visitor) const;
+    // Creates a node factory with its own pools that one thread can use to build subtrees while
+    // other threads do the same with theirs. Safe to call from any thread. The arena is owned
+    // by the document: ReleaseArena frees it, and all arenas go when the document's children
+    // are deleted (Parse, LoadFile, ParseBatch, DeleteChildren) or the document is destroyed.
+    // Every producer must be done with its arena by then; DEBUG builds assert it.
+    JsonArena *CreateArena();
+    // Frees arena with every node it made, e.g. once a request's subtree was deleted. None of
+    // those nodes may still be in the document. Safe to call from any thread.
+    void ReleaseArena(JsonArena *arena);
+
+    // Moves every node reachable from the document into fresh pool blocks in depth-first order,
+    // together with packed arrays and the strings that are not in the parse buffer, then frees
+    // the old blocks. Node pointers held by the caller are invalidated, batch roots are updated.
+    // Nodes made by a JsonArena are copied too when attached, but the arena keeps its blocks,
+    // and any unattached nodes, since its producer may still be using it: ReleaseArena it once
+    // the producer is done to free them.
+    void Compact();
+
+    // Copies every string still pointing into the parse buffer (a copy of the input) into the
+    // document's own string storage and frees the buffer, for documents that are kept long
+    // after parsing. With deduplicate, equal strings share a single copy. Lazy containers are
+    // parsed first, as they read from the buffer.
+    void DetachFromInput(bool deduplicate = false);
+
+    // Points all equal strings of at most maxLength bytes at one copy, like parsing with
+    // ParseOptions::DEDUP_STRINGS. Lazy containers are parsed first.
+    void DedupStrings(size_t maxLength = DEDUP_MAX_LENGTH);
+
+    // Sorts the members of every object by key, which also makes the printed output
+    // canonical, and indexes them for JsonObject::Find in storage released by the next parse.
+    // Lazy containers are parsed first.
+    void Freeze();
+
+protected:
+    // Makes the document draw all its memory from mem; see StaticJsonDocument.
+    void SetRegion(void *mem, size_t size);
+
 private:
+    enum : unsigned {
+        HEAP_OPTIONS = ParseOptions::PACK_NUMBERS | ParseOptions::PACK_SCALARS | ParseOptions::DEDUP_STRINGS
+    };
+
+    // Counts the containers being parsed into, for the TINYJSON_MAX_DEPTH check.
+    class DepthTracker
+    {
+    public:
+        explicit DepthTracker(JsonDocument *document) : _document(document)
+        {
+            ++_document->_parseDepth;
+        }
+        ~DepthTracker()
+        {
+            --_document->_parseDepth;
+        }
+        // Sets JSON_ERROR_DEPTH_EXCEEDED if so.
+        bool Exceeded() const;
+    private:
+        JsonDocument *_document;
+    };
+
+    struct CompactPools;
+    JsonNode *Relocate(const JsonNode *node, CompactPools *fresh);
+    template <class T, class Pool> T *NewNode(Pool *pool);
+    void ParseBuffer(size_t len);
+    void ReleaseArenas();
+    int NodeCount() const;
+    template <bool MINIFIED> char *ParseTrusted(char *json, JsonNode *parent);
+    const char *InternString(const char *str, size_t len);
     void InitDocument();
+    char *ReserveBuffer(size_t len);
+    char *ParseRoot(char *json, JsonNode **root);
 
 private:
     JsonError _errorID;
     const char *_errorStr1;
     const char *_errorStr2;
     char *_charBuffer;
+    size_t _charBufferSize;
+    int _parseDepth;
+    bool _hasLazyContent;
+
+    struct BatchEntry {
+        JsonNode *root;
+        JsonError error;
+        size_t length;
+    };
+    DynArray< BatchEntry, 16 > _batch;
+
+    DynArray< JsonArena *, 4 > _arenas;
+    std::mutex _arenaMutex;
+
+    unsigned _parseOptions;
+    // Packed array storage; released by the next parse.
+    MemArena _blobArena;
+    // Shared copies of deduplicated strings, kept in _blobArena.
+    StrTable _strTable;
+    // Set by StaticJsonDocument: pools, blob arena and parse buffer all draw from it.
+    MemRegion _region;
+    DynArray< int64_t, 64 > _packInts;
+    DynArray< double, 64 > _packDoubles;
+    DynArray< JsonValue, 64 > _packValues;
 
     MemPoolT< sizeof(JsonObject) > _objectPool;
     MemPoolT< sizeof(JsonArray) > _arrayPool;
@@ -666,10 +1580,238 @@ private:
     MemPoolT< sizeof(JsonReserved) > _reservedPool;
 };
 
+// Inline storage of a StaticJsonDocument, a base class so it is constructed first.
+template <size_t BYTES>
+struct StaticJsonBuffer {
+    alignas(16) char _inline[BYTES];
+};
+
+// Document that never calls new while parsing: nodes, the copy of the input and any other
+// per-parse data live in BYTES of inline storage, which each parse starts over. When it runs
+// out, parsing stops with JSON_ERROR_MEM_POOL_ERROR. The nodes take far more than the input:
+// every value is a node of up to 88 bytes, and every object member adds an element and a key
+// node, 160 bytes together, all taken in 1KB blocks per node type. So allow the input size
+// plus about 90 bytes per value and 160 per member, a few KB more for the blocks; an array of
+// 200 {"k":"v"} objects, 2001 bytes of input, needs 72KB. PACK_NUMBERS, PACK_SCALARS and
+// DEDUP_STRINGS are ignored, and Compact, DetachFromInput and DedupStrings do nothing.
+// ParseBatch stays heap-free for up to 16 messages.
+template <size_t BYTES>
+class StaticJsonDocument : private StaticJsonBuffer< BYTES >, public JsonDocument
+{
+public:
+    explicit StaticJsonDocument(unsigned parseOptions = ParseOptions::NONE) : JsonDocument(parseOptions)
+    {
+        SetRegion(this->_inline, BYTES);
+    }
+};
+
+// Creates nodes for a document from pools that belong to the arena alone, so each producer
+// thread can build its subtrees without locking. A finished subtree is attached with
+// InsertEndChild, which is O(1). Once attached, the subtree must only be touched by the
+// thread that owns the parent.
+class JsonArena
+{
+    friend JsonDocument;
+public:
+    JsonObject *NewObject();
+    JsonArray *NewArray();
+    // An element with its key already in place; InsertEndChild the value.
+    JsonElement *NewElement(const char *key);
+    JsonElement *NewElement(const char *key, size_t len);
+    JsonString *NewString(const char *str);
+    // len bytes, which may include nul characters.
+    JsonString *NewString(const char *str, size_t len);
+    JsonNumber *NewNumber(double value);
+    JsonNumber *NewNumber(int64_t value);
+    JsonNumber *NewNumber(int value)
+    {
+        return NewNumber((int64_t)value);
+    }
+    JsonReserved *NewReserved(JsonReserved::Type type);
+
+private:
+    explicit JsonArena(JsonDocument *doc);
+    ~JsonArena();
+
+    bool Owns(const JsonNode *node) const;
+
+    JsonDocument *_document;
+#ifdef DEBUG
+    // Allocations in progress, which must be none when the arena is freed.
+    std::atomic<int> _busy;
+#endif
+
+    MemPoolT< sizeof(JsonObject) > _objectPool;
+    MemPoolT< sizeof(JsonArray) > _arrayPool;
+    MemPoolT< sizeof(JsonElement) > _elementPool;
+    MemPoolT< sizeof(JsonNumber) > _numberPool;
+    MemPoolT< sizeof(JsonString) > _stringPool;
+    MemPoolT< sizeof(JsonReserved) > _reservedPool;
+    MemArena _strArena;
+};
+
+// Immutable, reference-counted JSON value for keeping many versions of a document. An edit
+// returns a new root that copies only the containers on the path to the change and shares
+// every other subtree with the old version. Each of those copies takes the container's whole
+// child array, so an edit costs O(depth) allocations but O(depth x width) time; very wide
+// objects and arrays make edits slow. Handles are cheap to copy and safe to share between
+// threads. An empty handle means "no value" and is what failed lookups and invalid edits
+// return.
+class JsonPersistent
+{
+public:
+    enum class Kind {
+        SCALAR = 0,
+        STRING,
+        ARRAY,
+        OBJECT
+    };
+
+    JsonPersistent() : _node(nullptr) {}
+    JsonPersistent(const JsonPersistent &other);
+    JsonPersistent &operator=(const JsonPersistent &other);
+    ~JsonPersistent();
+
+    // Deep copy of a parsed subtree; for a document, of its first root.
+    static JsonPersistent FromNode(const JsonNode *node);
+    // Numbers, booleans and null; node handles are not accepted.
+    static JsonPersistent Scalar(JsonValue value);
+    static JsonPersistent String(const char *str);
+    // len bytes, which may include nul characters.
+    static JsonPersistent String(const char *str, size_t len);
+    static JsonPersistent EmptyArray();
+    static JsonPersistent EmptyObject();
+
+    bool IsEmpty() const
+    {
+        return _node == nullptr;
+    }
+    Kind GetKind() const;
+    JsonValue Value() const;
+    const char *CStr() const;
+    // Members of an object, items of an array, bytes of a string.
+    int Size() const;
+
+    JsonPersistent At(int index) const;
+    const char *KeyAt(int index) const;
+    JsonPersistent Find(const char *key) const;
+
+    // Edits; the handle they are called on is left unchanged.
+    JsonPersistent Set(const char *key, const JsonPersistent &value) const;
+    JsonPersistent Set(int index, const JsonPersistent &value) const;
+    JsonPersistent Append(const JsonPersistent &value) const;
+    JsonPersistent Remove(const char *key) const;
+    // Replaces the value at path: object keys, or decimal indices for arrays. A missing last
+    // key is added; any other missing step makes the result empty.
+    JsonPersistent SetIn(const char *const *path, int depth, const JsonPersistent &value) const;
+
+    // True when both handles share the same subtree, e.g. an unedited branch of two versions.
+    bool SameAs(const JsonPersistent &other) const
+    {
+        return _node == other._node;
+    }
+    // Builds ordinary nodes, e.g. for printing, from the arena's pools.
+    JsonNode *ToNode(JsonArena *arena) const;
+
+    struct Node;
+
+private:
+    explicit JsonPersistent(Node *node) : _node(node) {}
+
+    Node *_node;
+};
+
+// One value in a JsonTape. Scalars keep their JsonValue bits in data. Strings keep their
+// length in size, and their offset into the string table in data. Arrays and objects keep
+// their item count in size, and the index of their first item in data. Items are consecutive
+// entries; for objects they are key and value pairs sorted by key.
+struct JsonTapeEntry {
+    uint32_t kind;
+    uint32_t size;
+    uint64_t data;
+};
+
+// Read-only JSON value over constant tables, for configs and lookup tables compiled into the
+// program. JsonTape::WriteSource turns a parsed document into C++ source defining a static
+// JsonTape, so nothing is parsed at startup and the data sits in read-only pages shared by
+// every process. Reads like JsonPersistent, with an empty handle for "no value"; Find is a
+// binary search.
+class JsonTape
+{
+public:
+    enum class Kind {
+        SCALAR = 0,
+        STRING,
+        ARRAY,
+        OBJECT
+    };
+
+    JsonTape() : _entries(nullptr), _strings(nullptr), _index(0) {}
+    constexpr JsonTape(const JsonTapeEntry *entries, const char *strings) :
+        _entries(entries), _strings(strings), _index(0) {}
+
+    bool IsEmpty() const
+    {
+        return _entries == nullptr;
+    }
+    // SCALAR for an empty handle, whose Value is null.
+    Kind GetKind() const
+    {
+        return _entries == nullptr ? Kind::SCALAR : (Kind)_entries[_index].kind;
+    }
+    JsonValue Value() const;
+    const char *CStr() const;
+    // Members of an object, items of an array, bytes of a string.
+    int Size() const;
+
+    JsonTape At(int index) const;
+    const char *KeyAt(int index) const;
+    JsonTape Find(const char *key) const;
+
+    // Writes C++ source defining `static const tinyjson::JsonTape name` and its tables, for
+    // node or, for a document, its first root. Keys and strings are stored once each. Numbers
+    // keep the double they were parsed to, so only integers beyond 2^53 are rounded.
+    static bool WriteSource(const JsonNode *node, const char *name, FILE *fp);
+
+private:
+    JsonTape(const JsonTapeEntry *entries, const char *strings, uint64_t index) :
+        _entries(entries), _strings(strings), _index(index) {}
+
+    const JsonTapeEntry *_entries;
+    const char *_strings;
+    uint64_t _index;
+};
+
+// Output format of JsonPrinter.
+struct WriterOptions {
+    // One member or item per line, indented by indent spaces per level. Otherwise there is no
+    // whitespace at all.
+    bool pretty;
+    int indent;
+    // Escapes everything from U+0080 up as \uXXXX, with surrogate pairs above U+FFFF, for
+    // consumers that only take ASCII.
+    bool asciiOnly;
+
+    WriterOptions() : pretty(true), indent(4), asciiOnly(false) {}
+};
+
+// Exact number of bytes JsonPrinter writes for node with options, found without writing them,
+// e.g. to size an output buffer or a Content-Length up front. 0 when Print would fail.
+size_t ComputeSerializedSize(const JsonNode &node, const WriterOptions &options = WriterOptions());
+
 class JsonPrinter : public JsonVisitor
 {
 public:
-    JsonPrinter() : _depth(0)
+    // Prints into a string, see GetString.
+    explicit JsonPrinter(const WriterOptions &options = WriterOptions()) :
+        _depth(0), _options(options), _toString(true), _buffer(nullptr), _capacity(0), _size(0),
+        _top(nullptr)
+    {}
+    // Prints into buffer, writing at most capacity bytes and no terminating nul. Size tells how
+    // many bytes the whole output takes; with a null buffer and capacity 0 it only counts.
+    JsonPrinter(char *buffer, size_t capacity, const WriterOptions &options = WriterOptions()) :
+        _depth(0), _options(options), _toString(false), _buffer(buffer), _capacity(capacity), _size(0),
+        _top(nullptr)
     {}
     virtual ~JsonPrinter() {}
 
@@ -677,20 +1819,97 @@ public:
     {
         return _out;
     }
+    size_t Size() const
+    {
+        return _size;
+    }
+
+    // node.Accept(this). To print into a buffer of the exact size, e.g. for a Content-Length,
+    // get the size from ComputeSerializedSize and use the buffer constructor. Under
+    // ParseOptions::LAZY the subtree is materialized first, and false is returned, with nothing
+    // printed, when that fails.
+    bool Print(const JsonNode &node);
+
+    // Prints node (or the document's single root) with its children split into ranges that are
+    // printed on the pool into separate buffers and appended in order. The output is the same as
+    // node.Accept(this). Containers with fewer than minChildren children are printed serially.
+    // False, with nothing printed, when a lazy container fails to parse.
+    bool ParallelPrint(const JsonNode &node, JsonThreadPool *pool, int minChildren = 1024);
+    virtual bool VisitEnter(const JsonDocument &node);
+    virtual bool VisitExit(const JsonDocument &node);
     virtual bool VisitEnter(const JsonObject &node);
     virtual bool VisitExit(const JsonObject &node);
     virtual bool VisitEnter(const JsonArray &node);
     virtual bool VisitExit(const JsonArray &node);
     virtual bool VisitEnter(const JsonElement &node);
+    virtual bool VisitExit(const JsonElement &node);
     virtual bool Visit(const JsonNumber &node);
     virtual bool Visit(const JsonString &node);
     virtual bool Visit(const JsonReserved &node);
 private:
+    void Write(const char *str, size_t len)
+    {
+        if (_toString) {
+            _out.append(str, len);
+        } else if (_size < _capacity) {
+            memcpy(_buffer + _size, str, len < _capacity - _size ? len : _capacity - _size);
+        }
+        _size += len;
+    }
+    void Write(const char *str)
+    {
+        Write(str, strlen(str));
+    }
     void PrintSpace(int depth);
     void PrintPrevSymbol(const JsonNode &node);
+    // Track the top node, and fire the print probes around it.
+    void BeginNode(const JsonNode &node);
+    void EndNode(const JsonNode &node);
+    size_t PrintEscape(const char *p, size_t left);
+    void PrintValue(JsonValue value);
 private:
     int _depth;
+    WriterOptions _options;
+    bool _toString;
+    char *_buffer;
+    size_t _capacity;
+    size_t _size;
     std::string _out;
+    // The node printing started on, printed as the top level even if it has siblings, e.g. a
+    // batch root; null between prints.
+    const JsonNode *_top;
+};
+
+// Fixed set of worker threads. ParallelFor hands out task indices one at a time from a shared
+// counter, so slow tasks don't hold up the rest of a batch.
+class JsonThreadPool
+{
+public:
+    explicit JsonThreadPool(int threadCount = 0);
+    ~JsonThreadPool();
+
+    int ThreadCount() const
+    {
+        return (int)_threads.size();
+    }
+
+    // Runs task(worker, index) for every index in [0, count) and returns when all are done.
+    // worker is in [0, ThreadCount()). Not reentrant: tasks must not call ParallelFor.
+    void ParallelFor(int count, const std::function<void(int, int)> &task);
+
+private:
+    void WorkerMain(int worker);
+
+    std::vector<std::thread> _threads;
+    std::mutex _mutex;
+    std::condition_variable _wake;
+    std::condition_variable _done;
+    const std::function<void(int, int)> *_task;
+    int _count;
+    std::atomic<int> _next;
+    int _active;
+    unsigned _generation;
+    bool _stop;
 };
 } //tinyjson
 #endif //TINYJSON_INCLUDED
\ No newline at end of file
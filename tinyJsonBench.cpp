@@ -0,0 +1,941 @@
+// Benchmark runner for the parser and the printer.
+//
+//     tinyJsonBench run [--counters] <file.json> [iterations]
+//     tinyJsonBench adversarial
+//     tinyJsonBench allocs <file.json>
+//     tinyJsonBench latency [--cpu <n>] [<file.json>] [calls]
+//     tinyJsonBench kernels
+//
+// run times Parse on a reused document and printing into a caller buffer. With --counters it
+// also reads the hardware counters around each benchmark (Linux perf_event_open) and reports
+// them per byte and per node; where they can't be opened, e.g. in a container or with
+// perf_event_paranoid set high, only the timings are shown. Counts are scaled for the time the
+// kernel multiplexed them out, and show as n/a for a counter that never got to run.
+//
+// adversarial builds pathological inputs at five doubling sizes and checks that parsing,
+// lookups and printing take about the same time per byte at each. It exits with 1 if that
+// time keeps growing with the size.
+//
+// allocs counts heap allocations per Parse, lookup and print on a reused document once it is
+// warmed up, under each parse option set, and exits with 1 if one that should take none does.
+//
+// latency times every single Parse and print of a small document (a built-in 200-byte request
+// by default) and reports percentiles from a histogram, for the per-call overhead and tail that
+// throughput figures average away. --cpu pins the thread to one CPU (Linux only).
+//
+// kernels checks that every SIMD kernel set the CPU supports gives the same results as the
+// scalar JsonUtil routines on random text, and exits with 1 if any differs.
+#include "tinyJson.h"
+#include <math.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <new>
+#include <vector>
+
+#if defined(__linux__)
+#include <sched.h>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+using namespace tinyjson;
+
+// Every heap allocation of the library goes through operator new, so replacing it here counts
+// them all. The counters are atomic since the thread pool allocates from its workers too.
+static std::atomic<size_t> allocationCount(0);
+static std::atomic<size_t> allocationBytes(0);
+
+void *operator new(size_t size)
+{
+    allocationCount.fetch_add(1, std::memory_order_relaxed);
+    allocationBytes.fetch_add(size, std::memory_order_relaxed);
+    void *p = malloc(size ? size : 1);
+    if (p == nullptr) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void *operator new[](size_t size)
+{
+    return operator new(size);
+}
+
+void *operator new(size_t size, const std::nothrow_t &) noexcept
+{
+    allocationCount.fetch_add(1, std::memory_order_relaxed);
+    allocationBytes.fetch_add(size, std::memory_order_relaxed);
+    return malloc(size ? size : 1);
+}
+
+void *operator new[](size_t size, const std::nothrow_t &tag) noexcept
+{
+    return operator new(size, tag);
+}
+
+// Kept out of line: once GCC inlines free into a caller it warns that the pointer came from
+// operator new rather than malloc.
+#if defined(__GNUC__)
+__attribute__((noinline))
+#endif
+static void FreeAllocation(void *p)
+{
+    free(p);
+}
+
+void operator delete(void *p) noexcept
+{
+    FreeAllocation(p);
+}
+
+void operator delete[](void *p) noexcept
+{
+    FreeAllocation(p);
+}
+
+void operator delete(void *p, const std::nothrow_t &) noexcept
+{
+    FreeAllocation(p);
+}
+
+void operator delete[](void *p, const std::nothrow_t &) noexcept
+{
+    FreeAllocation(p);
+}
+
+// C++14 callers pass the size back; without these the library's sized operator delete would
+// free what ours malloc'ed.
+void operator delete(void *p, size_t) noexcept
+{
+    FreeAllocation(p);
+}
+
+void operator delete[](void *p, size_t) noexcept
+{
+    FreeAllocation(p);
+}
+
+namespace
+{
+
+// A fixed set of counters, each opened on its own so that one the CPU lacks (LLC misses on
+// some virtual machines) doesn't take the others with it.
+class PerfCounters
+{
+public:
+    enum { CYCLES, INSTRUCTIONS, BRANCH_MISSES, L1D_MISSES, LLC_MISSES, COUNT };
+
+    PerfCounters()
+    {
+        for (int i = 0; i < COUNT; ++i) {
+            _fds[i] = -1;
+            _values[i] = 0;
+            _counted[i] = false;
+        }
+    }
+    ~PerfCounters()
+    {
+#if defined(__linux__)
+        for (int i = 0; i < COUNT; ++i) {
+            if (_fds[i] >= 0) {
+                close(_fds[i]);
+            }
+        }
+#endif
+    }
+
+    // False if none of the counters could be opened.
+    bool Open()
+    {
+#if defined(__linux__)
+        static const uint32_t cacheL1D = PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+            | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+        const uint32_t types[COUNT] = { PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE,
+            PERF_TYPE_HW_CACHE, PERF_TYPE_HARDWARE };
+        const uint64_t configs[COUNT] = { PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+            PERF_COUNT_HW_BRANCH_MISSES, cacheL1D, PERF_COUNT_HW_CACHE_MISSES };
+        bool any = false;
+        for (int i = 0; i < COUNT; ++i) {
+            perf_event_attr attr;
+            memset(&attr, 0, sizeof(attr));
+            attr.size = sizeof(attr);
+            attr.type = types[i];
+            attr.config = configs[i];
+            attr.disabled = 1;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            // With more events than hardware counters the kernel multiplexes them, so each
+            // reports how long it was actually counting.
+            attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+            _fds[i] = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+            any = any || _fds[i] >= 0;
+        }
+        return any;
+#else
+        return false;
+#endif
+    }
+
+    void Start()
+    {
+#if defined(__linux__)
+        for (int i = 0; i < COUNT; ++i) {
+            if (_fds[i] >= 0) {
+                ioctl(_fds[i], PERF_EVENT_IOC_RESET, 0);
+                ioctl(_fds[i], PERF_EVENT_IOC_ENABLE, 0);
+            }
+        }
+#endif
+    }
+
+    void Stop()
+    {
+#if defined(__linux__)
+        for (int i = 0; i < COUNT; ++i) {
+            if (_fds[i] >= 0) {
+                ioctl(_fds[i], PERF_EVENT_IOC_DISABLE, 0);
+                // The count, then the time enabled and the time running.
+                uint64_t data[3] = {};
+                _counted[i] = read(_fds[i], data, sizeof(data)) == sizeof(data) && data[2] != 0;
+                // Scaled up to the whole time enabled, an estimate when it was multiplexed.
+                _values[i] = _counted[i] ? (uint64_t)((double)data[0] * data[1] / data[2]) : 0;
+            }
+        }
+#endif
+    }
+
+    // Whether counter was opened and got scheduled between the last Start and Stop.
+    bool Has(int counter) const
+    {
+        return _fds[counter] >= 0 && _counted[counter];
+    }
+    uint64_t Value(int counter) const
+    {
+        return _values[counter];
+    }
+
+private:
+    int _fds[COUNT];
+    uint64_t _values[COUNT];
+    bool _counted[COUNT];
+};
+
+double Seconds(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Walks the tree without recursion, as deeply nested input is a benchmark of its own.
+size_t CountNodes(const JsonNode *root)
+{
+    size_t count = 0;
+    const JsonNode *node = root->FirstChild();
+    while (node != nullptr) {
+        ++count;
+        if (node->FirstChild() != nullptr) {
+            node = node->FirstChild();
+            continue;
+        }
+        while (node != root && node->NextSibling() == nullptr) {
+            node = node->Parent();
+        }
+        node = node != root ? node->NextSibling() : nullptr;
+    }
+    return count;
+}
+
+bool ReadFile(const char *path, std::vector<char> *out)
+{
+    FILE *fp = fopen(path, "rb");
+    if (fp == nullptr) {
+        return false;
+    }
+    char chunk[65536];
+    size_t n;
+    while ((n = fread(chunk, 1, sizeof(chunk), fp)) > 0) {
+        out->insert(out->end(), chunk, chunk + n);
+    }
+    bool ok = !ferror(fp);
+    fclose(fp);
+    return ok;
+}
+
+void Report(const char *name, double seconds, int iterations, size_t bytes, size_t nodes,
+    const PerfCounters *counters)
+{
+    printf("%-6s %9.1f MB/s %10.1f ns/node\n", name, bytes * (double)iterations / seconds / 1e6,
+        seconds * 1e9 / iterations / (nodes ? nodes : 1));
+    if (counters == nullptr) {
+        return;
+    }
+    static const char *const names[PerfCounters::COUNT] = {
+        "cycles", "instructions", "branch-misses", "L1d-misses", "LLC-misses"
+    };
+    double perByte = 1.0 / ((double)bytes * iterations);
+    double perNode = 1.0 / ((double)(nodes ? nodes : 1) * iterations);
+    for (int i = 0; i < PerfCounters::COUNT; ++i) {
+        if (!counters->Has(i)) {
+            printf("       %-14s n/a\n", names[i]);
+            continue;
+        }
+        printf("       %-14s %10.3f /byte %10.3f /node\n", names[i],
+            counters->Value(i) * perByte, counters->Value(i) * perNode);
+    }
+    if (counters->Has(PerfCounters::CYCLES) && counters->Has(PerfCounters::INSTRUCTIONS)
+            && counters->Value(PerfCounters::CYCLES) != 0) {
+        printf("       %-14s %10.3f\n", "IPC",
+            (double)counters->Value(PerfCounters::INSTRUCTIONS) / counters->Value(PerfCounters::CYCLES));
+    }
+}
+
+int Run(int argc, char **argv)
+{
+    bool useCounters = false;
+    int arg = 0;
+    if (arg < argc && !strcmp(argv[arg], "--counters")) {
+        useCounters = true;
+        ++arg;
+    }
+    if (arg >= argc) {
+        return 2;
+    }
+    const char *path = argv[arg++];
+    int iterations = arg < argc ? atoi(argv[arg]) : 100;
+    if (iterations <= 0) {
+        return 2;
+    }
+
+    std::vector<char> input;
+    if (!ReadFile(path, &input)) {
+        fprintf(stderr, "%s: could not be read\n", path);
+        return 1;
+    }
+    JsonDocument doc;
+    if (doc.Parse(input.data(), input.size()) != JsonError::JSON_NO_ERROR) {
+        fprintf(stderr, "%s: parse error %d\n", path, (int)doc.ErrorID());
+        return 1;
+    }
+    size_t nodes = CountNodes(&doc);
+    std::vector<char> output(ComputeSerializedSize(doc) + 1);
+
+    PerfCounters counters;
+    const PerfCounters *report = nullptr;
+    if (useCounters) {
+        if (counters.Open()) {
+            report = &counters;
+        } else {
+            fprintf(stderr, "hardware counters unavailable; timings only\n");
+        }
+    }
+    printf("%s: %zu bytes, %zu nodes, %d iterations, %s kernels\n", path, input.size(), nodes,
+        iterations, JsonKernels::Get().name);
+
+    counters.Start();
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; ++i) {
+        doc.Parse(input.data(), input.size());
+    }
+    double seconds = Seconds(start);
+    counters.Stop();
+    Report("parse", seconds, iterations, input.size(), nodes, report);
+
+    counters.Start();
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; ++i) {
+        JsonPrinter printer(output.data(), output.size());
+        doc.Accept(&printer);
+    }
+    seconds = Seconds(start);
+    counters.Stop();
+    Report("print", seconds, iterations, output.size() - 1, nodes, report);
+    return 0;
+}
+
+// Input of roughly n units (levels, members, bytes) for one adversarial case.
+typedef void (*AdversarialBuilder)(size_t n, std::string *out);
+
+void BuildDeepNesting(size_t n, std::string *out)
+{
+    out->assign(n, '[');
+    out->append(n, ']');
+}
+
+void BuildWideObject(size_t n, std::string *out)
+{
+    char member[32];
+    out->assign("{");
+    for (size_t i = 0; i < n; ++i) {
+        out->append(member, snprintf(member, sizeof(member), "%s\"k%zu\":%zu", i ? "," : "", i, i));
+    }
+    out->append("}");
+}
+
+void BuildEscapedString(size_t n, std::string *out)
+{
+    static const char *const escapes[] = { "\\n", "\\\"", "\\\\", "\\u00e9", "\\ud83d\\ude00", "\\u0001" };
+    out->assign("[\"");
+    for (size_t i = 0; out->size() < n; ++i) {
+        out->append(escapes[i % (sizeof(escapes) / sizeof(escapes[0]))]);
+    }
+    out->append("\"]");
+}
+
+void BuildLongNumbers(size_t n, std::string *out)
+{
+    out->assign("[");
+    for (size_t i = 0; i < n; ++i) {
+        out->append(i ? ",-1." : "-1.");
+        out->append(10000, (char)('1' + i % 9));
+        out->append("e-5");
+    }
+    out->append("]");
+}
+
+void BuildDuplicateKeys(size_t n, std::string *out)
+{
+    out->assign("{");
+    for (size_t i = 0; i < n; ++i) {
+        out->append(i ? ",\"k\":[]" : "\"k\":[]");
+    }
+    out->append("}");
+}
+
+void BuildWhitespace(size_t n, std::string *out)
+{
+    out->assign("[");
+    for (int i = 0; i < 8; ++i) {
+        out->append(n / 8, i % 2 ? ' ' : '\n');
+        out->append(i ? ",0" : "0");
+    }
+    out->append(n / 8, '\t');
+    out->append("]");
+}
+
+struct AdversarialCase {
+    const char *name;
+    AdversarialBuilder build;
+    size_t baseSize;
+    // Input nested past TINYJSON_MAX_DEPTH, which must be turned down quickly.
+    bool rejected;
+};
+
+// Best of several runs of op, in seconds, to keep scheduling noise out of the scaling check.
+template <class Op>
+double BestOf(Op op)
+{
+    double best = 1e30;
+    for (int run = 0; run < 9; ++run) {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        op();
+        double seconds = Seconds(start);
+        best = seconds < best ? seconds : best;
+    }
+    return best;
+}
+
+enum { SCALING_STEPS = 5 };
+
+// How fast the time per byte grows with the size, as an exponent: 0 when linear, 1 when
+// quadratic. Taken at the doubling where it grew least, since running out of one cache level
+// makes a single doubling look superlinear while quadratic work shows at every one.
+double PerByteGrowth(const double *seconds, const size_t *bytes)
+{
+    double least = 1e30;
+    for (int step = 1; step < SCALING_STEPS; ++step) {
+        double ratio = (seconds[step] / bytes[step]) / (seconds[step - 1] / bytes[step - 1]);
+        least = std::min(least, log(ratio) / log((double)bytes[step] / bytes[step - 1]));
+    }
+    return least;
+}
+
+int Adversarial()
+{
+    static const AdversarialCase cases[] = {
+        { "deep nesting", &BuildDeepNesting, 12500, true },
+        { "wide object", &BuildWideObject, 125000, false },
+        { "escaped string", &BuildEscapedString, 1 << 20, false },
+        { "long numbers", &BuildLongNumbers, 25, false },
+        { "duplicate keys", &BuildDuplicateKeys, 125000, false },
+        { "whitespace", &BuildWhitespace, 2 << 20, false },
+    };
+    // Timer resolution and caches make the time per byte vary a little; quadratic work grows
+    // it by 1 at every doubling, and 16 times over the whole range.
+    const double growthLimit = 0.3;
+    const double rangeLimit = 4;
+    const char *const ops[] = { "parse", "lookup", "print" };
+    bool ok = true;
+
+    for (size_t c = 0; c < sizeof(cases) / sizeof(cases[0]); ++c) {
+        const AdversarialCase &test = cases[c];
+        double seconds[3][SCALING_STEPS] = {};
+        bool timed[3] = { true, false, false };
+        size_t bytes[SCALING_STEPS] = {};
+        for (int step = 0; step < SCALING_STEPS; ++step) {
+            std::string input;
+            test.build(test.baseSize << step, &input);
+            bytes[step] = input.size();
+
+            JsonDocument doc;
+            seconds[0][step] = BestOf([&]() { doc.Parse(input.data(), input.size()); });
+            JsonError error = doc.ErrorID();
+            if ((error != JsonError::JSON_NO_ERROR) != test.rejected
+                    || (test.rejected && error != JsonError::JSON_ERROR_DEPTH_EXCEEDED)) {
+                printf("%-16s unexpected parse result %d at %zu bytes\n", test.name, (int)error, bytes[step]);
+                ok = false;
+                break;
+            }
+            if (test.rejected) {
+                continue;
+            }
+
+            // A key that isn't there makes Find look at every member.
+            const JsonObject *object = doc.FirstChild()->ToObject();
+            if (object != nullptr) {
+                timed[1] = true;
+                seconds[1][step] = BestOf([&]() {
+                    for (int i = 0; i < 10; ++i) {
+                        if (object->Find("missing") != nullptr) {
+                            abort();
+                        }
+                    }
+                });
+            }
+
+            WriterOptions options;
+            options.pretty = false;
+            std::vector<char> output(ComputeSerializedSize(doc, options));
+            timed[2] = true;
+            seconds[2][step] = BestOf([&]() {
+                JsonPrinter printer(output.data(), output.size(), options);
+                doc.Accept(&printer);
+            });
+        }
+
+        for (int op = 0; op < 3; ++op) {
+            if (!timed[op] || seconds[op][0] <= 0) {
+                continue;
+            }
+            const int last = SCALING_STEPS - 1;
+            double growth = PerByteGrowth(seconds[op], bytes);
+            double range = (seconds[op][last] / bytes[last]) / (seconds[op][0] / bytes[0]);
+            bool linear = growth <= growthLimit && range <= rangeLimit;
+            ok = ok && linear;
+            printf("%-16s %-6s %9.3f ms at %9zu bytes, %7.3f ns/byte (x%.2f from %zu bytes, growth %+.2f) %s\n",
+                test.name, ops[op], seconds[op][last] * 1e3, bytes[last], seconds[op][last] / bytes[last] * 1e9,
+                range, bytes[0], growth, linear ? "ok" : "SUPERLINEAR");
+        }
+    }
+    return ok ? 0 : 1;
+}
+
+// Allocations made by op, on average over a number of calls after the first few.
+struct AllocationStats {
+    double count;
+    double bytes;
+};
+
+template <class Op>
+AllocationStats CountAllocations(Op op)
+{
+    const int warmup = 3;
+    const int calls = 20;
+    for (int i = 0; i < warmup; ++i) {
+        op();
+    }
+    size_t count = allocationCount.load();
+    size_t bytes = allocationBytes.load();
+    for (int i = 0; i < calls; ++i) {
+        op();
+    }
+    AllocationStats stats = { (double)(allocationCount.load() - count) / calls,
+                              (double)(allocationBytes.load() - bytes) / calls };
+    return stats;
+}
+
+// Every member of every object in the tree, for the lookup benchmark.
+void CollectKeys(const JsonNode *root, std::vector< std::pair<const JsonObject *, std::string> > *out)
+{
+    const JsonNode *node = root->FirstChild();
+    while (node != nullptr) {
+        const JsonElement *element = node->ToElement();
+        if (element != nullptr && element->Key() != nullptr) {
+            out->push_back(std::make_pair(node->Parent()->ToObject(), std::string(element->Key()->CStr())));
+        }
+        if (node->FirstChild() != nullptr) {
+            node = node->FirstChild();
+            continue;
+        }
+        while (node != root && node->NextSibling() == nullptr) {
+            node = node->Parent();
+        }
+        node = node != root ? node->NextSibling() : nullptr;
+    }
+}
+
+int Allocs(const char *path)
+{
+    std::vector<char> input;
+    if (!ReadFile(path, &input)) {
+        fprintf(stderr, "%s: could not be read\n", path);
+        return 1;
+    }
+    struct OptionSet {
+        const char *name;
+        unsigned options;
+    };
+    static const OptionSet optionSets[] = {
+        { "default", ParseOptions::NONE },
+        { "pack", ParseOptions::PACK_SCALARS },
+        { "lazy", ParseOptions::LAZY },
+        { "dedup", ParseOptions::DEDUP_STRINGS },
+        { "trusted", ParseOptions::TRUSTED },
+    };
+
+    bool ok = true;
+    printf("%-8s %-14s %10s %12s\n", "options", "operation", "allocs/op", "bytes/op");
+    for (size_t o = 0; o < sizeof(optionSets) / sizeof(optionSets[0]); ++o) {
+        JsonDocument doc(optionSets[o].options);
+        if (doc.Parse(input.data(), input.size()) != JsonError::JSON_NO_ERROR) {
+            fprintf(stderr, "%s: parse error %d\n", path, (int)doc.ErrorID());
+            return 1;
+        }
+
+        struct Result {
+            const char *operation;
+            AllocationStats stats;
+            // Whether a reused document and buffer should get by without the heap.
+            bool steady;
+        };
+        Result results[4];
+        results[0].operation = "parse";
+        results[0].stats = CountAllocations([&]() { doc.Parse(input.data(), input.size()); });
+        results[0].steady = true;
+
+        // Materialize lazy containers once, so lookups measure lookups.
+        doc.MaterializeAll();
+        std::vector< std::pair<const JsonObject *, std::string> > keys;
+        CollectKeys(&doc, &keys);
+        results[1].operation = "lookup";
+        results[1].stats = CountAllocations([&]() {
+            for (size_t i = 0; i < keys.size(); ++i) {
+                if (keys[i].first->Find(keys[i].second.c_str()) == nullptr) {
+                    abort();
+                }
+            }
+        });
+        results[1].steady = true;
+
+        std::vector<char> output(ComputeSerializedSize(doc));
+        results[2].operation = "print buffer";
+        results[2].stats = CountAllocations([&]() {
+            JsonPrinter printer(output.data(), output.size());
+            doc.Accept(&printer);
+        });
+        results[2].steady = true;
+
+        // A fresh string each time, grown as the output comes.
+        results[3].operation = "print string";
+        results[3].stats = CountAllocations([&]() {
+            JsonPrinter printer;
+            printer.Print(doc);
+        });
+        results[3].steady = false;
+
+        for (int i = 0; i < 4; ++i) {
+            bool failed = results[i].steady && results[i].stats.count != 0;
+            ok = ok && !failed;
+            printf("%-8s %-14s %10.2f %12.1f%s\n", optionSets[o].name, results[i].operation,
+                results[i].stats.count, results[i].stats.bytes, failed ? "  UNEXPECTED" : "");
+        }
+    }
+    return ok ? 0 : 1;
+}
+
+// Log-linear histogram in the manner of HdrHistogram: values below 2 * SUB_BUCKETS are exact,
+// above that every power of two is split into SUB_BUCKETS buckets, so a percentile is off by
+// at most 1 / SUB_BUCKETS of its value.
+class LatencyHistogram
+{
+public:
+    enum { SUB_BITS = 5, SUB_BUCKETS = 1 << SUB_BITS, BUCKETS = (64 - SUB_BITS + 1) * SUB_BUCKETS };
+
+    LatencyHistogram() : _total(0), _sum(0), _max(0)
+    {
+        memset(_counts, 0, sizeof(_counts));
+    }
+
+    void Record(uint64_t value)
+    {
+        ++_counts[Index(value)];
+        ++_total;
+        _sum += value;
+        _max = value > _max ? value : _max;
+    }
+
+    // Smallest bucket bound that fraction of the values do not exceed, e.g. 0.99 for p99.
+    uint64_t Percentile(double fraction) const
+    {
+        uint64_t rank = (uint64_t)ceil(fraction * _total);
+        uint64_t seen = 0;
+        for (int i = 0; i < BUCKETS; ++i) {
+            seen += _counts[i];
+            if (seen >= rank && seen != 0) {
+                uint64_t bound = UpperBound(i);
+                return bound < _max ? bound : _max;
+            }
+        }
+        return _max;
+    }
+    double Mean() const
+    {
+        return _total ? (double)_sum / _total : 0;
+    }
+    uint64_t Max() const
+    {
+        return _max;
+    }
+
+private:
+    static int Index(uint64_t value)
+    {
+        if (value < 2 * SUB_BUCKETS) {
+            return (int)value;
+        }
+        int shift = 0;
+        while ((value >> shift) >= 2 * SUB_BUCKETS) {
+            ++shift;
+        }
+        return (shift + 1) * SUB_BUCKETS + (int)(value >> shift) - SUB_BUCKETS;
+    }
+    static uint64_t UpperBound(int index)
+    {
+        if (index < 2 * SUB_BUCKETS) {
+            return (uint64_t)index;
+        }
+        int shift = index / SUB_BUCKETS - 1;
+        uint64_t sub = (uint64_t)(index % SUB_BUCKETS + SUB_BUCKETS);
+        return ((sub + 1) << shift) - 1;
+    }
+
+    uint64_t _counts[BUCKETS];
+    uint64_t _total;
+    uint64_t _sum;
+    uint64_t _max;
+};
+
+uint64_t Nanoseconds(std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point end)
+{
+    return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+}
+
+void ReportLatency(const char *name, const LatencyHistogram &histogram)
+{
+    printf("%-6s %8.0f %8llu %8llu %8llu %8llu %8llu\n", name, histogram.Mean(),
+        (unsigned long long)histogram.Percentile(0.5), (unsigned long long)histogram.Percentile(0.9),
+        (unsigned long long)histogram.Percentile(0.99), (unsigned long long)histogram.Percentile(0.999),
+        (unsigned long long)histogram.Max());
+}
+
+int Latency(int argc, char **argv)
+{
+    static const char request[] =
+        "{\"id\":184467,\"user\":\"alice\",\"action\":\"update\",\"session\":\"b6f1c2e0\","
+        "\"items\":[{\"sku\":\"A-1001\",\"qty\":2,\"price\":19.99},{\"sku\":\"B-0007\",\"qty\":1,"
+        "\"price\":4.5}],\"express\":true,\"coupon\":null,\"note\":\"leave at door\"}";
+
+    int cpu = -1;
+    int arg = 0;
+    if (arg + 1 < argc && !strcmp(argv[arg], "--cpu")) {
+        cpu = atoi(argv[arg + 1]);
+        arg += 2;
+    }
+    std::vector<char> input(request, request + sizeof(request) - 1);
+    if (arg < argc && atoi(argv[arg]) <= 0) {
+        input.clear();
+        if (!ReadFile(argv[arg], &input)) {
+            fprintf(stderr, "%s: could not be read\n", argv[arg]);
+            return 1;
+        }
+        ++arg;
+    }
+    int calls = arg < argc ? atoi(argv[arg++]) : 1000000;
+    if (calls <= 0 || arg != argc) {
+        return 2;
+    }
+
+    if (cpu >= 0) {
+#if defined(__linux__)
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        if (sched_setaffinity(0, sizeof(set), &set) != 0) {
+            fprintf(stderr, "could not pin to CPU %d\n", cpu);
+            return 1;
+        }
+#else
+        fprintf(stderr, "--cpu is only supported on Linux\n");
+        return 1;
+#endif
+    }
+
+    JsonDocument doc;
+    if (doc.Parse(input.data(), input.size()) != JsonError::JSON_NO_ERROR) {
+        fprintf(stderr, "parse error %d\n", (int)doc.ErrorID());
+        return 1;
+    }
+    std::vector<char> output(ComputeSerializedSize(doc));
+
+    // What reading the clock adds to every sample.
+    LatencyHistogram clock;
+    LatencyHistogram parse;
+    LatencyHistogram print;
+    for (int i = 0; i < calls / 10; ++i) {
+        doc.Parse(input.data(), input.size());
+        JsonPrinter printer(output.data(), output.size());
+        doc.Accept(&printer);
+    }
+    for (int i = 0; i < calls; ++i) {
+        std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+        std::chrono::steady_clock::time_point t1 = std::chrono::steady_clock::now();
+        doc.Parse(input.data(), input.size());
+        std::chrono::steady_clock::time_point t2 = std::chrono::steady_clock::now();
+        JsonPrinter printer(output.data(), output.size());
+        doc.Accept(&printer);
+        std::chrono::steady_clock::time_point t3 = std::chrono::steady_clock::now();
+        clock.Record(Nanoseconds(t0, t1));
+        parse.Record(Nanoseconds(t1, t2));
+        print.Record(Nanoseconds(t2, t3));
+    }
+
+    printf("%zu bytes, %d calls%s, nanoseconds per call\n", input.size(), calls, cpu >= 0 ? ", pinned" : "");
+    printf("%-6s %8s %8s %8s %8s %8s %8s\n", "", "mean", "p50", "p90", "p99", "p99.9", "max");
+    ReportLatency("parse", parse);
+    ReportLatency("print", print);
+    ReportLatency("clock", clock);
+    return 0;
+}
+
+// Deterministic xorshift generator, so a failing input can be reproduced.
+class Random
+{
+public:
+    explicit Random(uint64_t seed) : _state(seed) {}
+    uint32_t Next()
+    {
+        _state ^= _state << 13;
+        _state ^= _state >> 7;
+        _state ^= _state << 17;
+        return (uint32_t)(_state >> 32);
+    }
+
+private:
+    uint64_t _state;
+};
+
+// Fills [p, p + len) from bytes every kernel treats specially, mixed with valid UTF-8 sequences
+// so the validator sees both outcomes.
+void RandomText(Random *random, char *p, size_t len)
+{
+    static const char special[] = " \t\n\r\v\f\"\\{}[]:,\x01\x1f\x7f" "ab0";
+    static const char *const sequences[] = { "\xc3\xa9", "\xe2\x82\xac", "\xf0\x9f\x98\x80", "\xed\x9f\xbf" };
+    size_t i = 0;
+    while (i < len) {
+        uint32_t r = random->Next();
+        if (r % 8 == 0 && i + 4 <= len) {
+            const char *sequence = sequences[(r >> 8) % 4];
+            size_t n = strlen(sequence);
+            memcpy(p + i, sequence, n);
+            i += n;
+        } else if (r % 64 == 1) {
+            p[i++] = (char)(0x80 | (r >> 8));
+        } else {
+            p[i++] = special[(r >> 8) % (sizeof(special) - 1)];
+        }
+    }
+}
+
+// Checks every kernel set the CPU supports against the scalar JsonUtil routines on random text
+// at every alignment and at lengths around the vector widths. Exits with 1 on a mismatch.
+int Kernels()
+{
+    const JsonKernels *scalar = JsonKernels::Find(JsonKernels::Level::SCALAR);
+    const size_t maxLength = 300;
+    const int rounds = 200;
+    // Room for the widest block read past the nul, and 64-byte aligned like AVX-512 loads.
+    std::vector<char> storage(maxLength + 64 * 3);
+    char *base = (char *)(((uintptr_t)storage.data() + 63) & ~(uintptr_t)63);
+    std::vector<uint32_t> expected(maxLength);
+    std::vector<uint32_t> actual(maxLength);
+
+    bool ok = true;
+    for (int level = (int)JsonKernels::Level::SSE2; level <= (int)JsonKernels::Detect(); ++level) {
+        const JsonKernels *kernels = JsonKernels::Find((JsonKernels::Level)level);
+        if (kernels == nullptr) {
+            continue;
+        }
+        Random random(0x9E3779B97F4A7C15ull);
+        size_t checks = 0;
+        size_t failures = 0;
+        for (int round = 0; round < rounds; ++round) {
+            for (size_t offset = 0; offset < 64; ++offset) {
+                size_t len = random.Next() % (maxLength - 64);
+                char *p = base + offset;
+                RandomText(&random, p, len);
+                p[len] = 0;
+                // Whitespace runs of every length, so skipWhiteSpace gets past the first block.
+                size_t spaces = random.Next() % (len + 1);
+                memset(p, ' ', spaces);
+
+                bool same = kernels->skipWhiteSpace(p) == scalar->skipWhiteSpace(p)
+                    && kernels->scanString(p) == scalar->scanString(p)
+                    && kernels->validateUTF8(p, len) == scalar->validateUTF8(p, len)
+                    && kernels->cleanRun(p, len, false) == scalar->cleanRun(p, len, false)
+                    && kernels->cleanRun(p, len, true) == scalar->cleanRun(p, len, true);
+                size_t count = scalar->indexStructurals(p, len, expected.data());
+                same = same && kernels->indexStructurals(p, len, actual.data()) == count
+                    && std::equal(expected.begin(), expected.begin() + count, actual.begin());
+                ++checks;
+                if (!same) {
+                    if (failures == 0) {
+                        fprintf(stderr, "%s: mismatch at offset %zu, length %zu, round %d\n",
+                            kernels->name, offset, len, round);
+                    }
+                    ++failures;
+                }
+            }
+        }
+        ok = ok && failures == 0;
+        printf("%-8s %8zu inputs %8zu mismatches\n", kernels->name, checks, failures);
+    }
+    return ok ? 0 : 1;
+}
+
+}
+
+int main(int argc, char **argv)
+{
+    int result = 2;
+    if (argc >= 2 && !strcmp(argv[1], "run")) {
+        result = Run(argc - 2, argv + 2);
+    } else if (argc == 2 && !strcmp(argv[1], "adversarial")) {
+        result = Adversarial();
+    } else if (argc == 3 && !strcmp(argv[1], "allocs")) {
+        result = Allocs(argv[2]);
+    } else if (argc >= 2 && !strcmp(argv[1], "latency")) {
+        result = Latency(argc - 2, argv + 2);
+    } else if (argc == 2 && !strcmp(argv[1], "kernels")) {
+        result = Kernels();
+    }
+    if (result == 2) {
+        fprintf(stderr, "usage: %s run [--counters] <file.json> [iterations]\n"
+            "       %s adversarial\n"
+            "       %s allocs <file.json>\n"
+            "       %s latency [--cpu <n>] [<file.json>] [calls]\n"
+            "       %s kernels\n", argv[0], argv[0], argv[0], argv[0], argv[0]);
+    }
+    return result;
+}
@@ -0,0 +1,30 @@
+// Build-time generator for embedded JSON: parses a file and prints C++ source defining a
+// static tinyjson::JsonTape over it, to be compiled into the program.
+//
+//     tinyJsonEmbed defaults.json kDefaults > defaults.inc
+#include "tinyJson.h"
+
+using namespace tinyjson;
+
+int main(int argc, char **argv)
+{
+    if (argc != 3) {
+        fprintf(stderr, "usage: %s <file.json> <name>\n", argv[0]);
+        return 2;
+    }
+
+    JsonDocument doc;
+    JsonError error = doc.LoadFile(argv[1]);
+    if (error != JsonError::JSON_NO_ERROR) {
+        fprintf(stderr, "%s: parse error %d\n", argv[1], (int)error);
+        return 1;
+    }
+
+    printf("// Generated from %s by tinyJsonEmbed; do not edit.\n", argv[1]);
+    printf("#include \"tinyJson.h\"\n\n");
+    if (!JsonTape::WriteSource(&doc, argv[2], stdout)) {
+        fprintf(stderr, "%s: nothing to embed\n", argv[1]);
+        return 1;
+    }
+    return 0;
+}